@@ -0,0 +1,154 @@
+#include "deadline.h"
+#include "app_timer.h"
+#include "app_error.h"
+#include "timestamping.h"
+
+/* The timer and the time base are both RTC1 at 32768 Hz (PRESCALER 0), so
+ * deadlines are kept in timestamp ticks and passed to app_timer as is.
+ */
+#define MS_TO_TICKS(MS)     ((((uint64_t)(MS)) * TIMESTAMP_TICK_FREQ + 500) / 1000)
+/* Longest single-shot timeout, app_timer can only handle half the counter. */
+#define MAX_TIMEOUT_TICKS   (TIMESTAMP_COUNTER_MASK / 2)
+
+typedef struct {
+    uint64_t due;
+    uint32_t period;
+    deadline_handler_t handler;
+} deadline_task_t;
+
+/* Min-heap on due. */
+static deadline_task_t m_heap[DEADLINE_MAX_TASKS];
+static uint8_t m_count;
+
+APP_TIMER_DEF(m_deadline_timer_id);
+
+static void heap_swap(uint8_t a, uint8_t b)
+{
+    deadline_task_t tmp = m_heap[a];
+    m_heap[a] = m_heap[b];
+    m_heap[b] = tmp;
+}
+
+static void heap_up(uint8_t idx)
+{
+    uint8_t parent;
+
+    while (idx) {
+        parent = (idx - 1) / 2;
+        if (m_heap[parent].due <= m_heap[idx].due) {
+            break;
+        }
+        heap_swap(parent, idx);
+        idx = parent;
+    }
+}
+
+static void heap_down(uint8_t idx)
+{
+    uint8_t child, smallest;
+
+    for (;;) {
+        smallest = idx;
+        child = 2 * idx + 1;
+        if ((child < m_count) && (m_heap[child].due < m_heap[smallest].due)) {
+            smallest = child;
+        }
+        child++;
+        if ((child < m_count) && (m_heap[child].due < m_heap[smallest].due)) {
+            smallest = child;
+        }
+        if (smallest == idx) {
+            break;
+        }
+        heap_swap(smallest, idx);
+        idx = smallest;
+    }
+}
+
+/* Set the timer to the earliest deadline. */
+static void deadline_arm(uint64_t now)
+{
+    uint64_t timeout;
+
+    APP_ERROR_CHECK(app_timer_stop(m_deadline_timer_id));
+    if (!m_count) {
+        return;
+    }
+    timeout = (m_heap[0].due > now) ? (m_heap[0].due - now) : 0;
+    if (timeout < APP_TIMER_MIN_TIMEOUT_TICKS) {
+        timeout = APP_TIMER_MIN_TIMEOUT_TICKS;
+    } else if (timeout > MAX_TIMEOUT_TICKS) {
+        timeout = MAX_TIMEOUT_TICKS;
+    }
+    APP_ERROR_CHECK(app_timer_start(m_deadline_timer_id, (uint32_t)timeout,
+        NULL));
+}
+
+static void deadline_timeout_handler(void * p_context)
+{
+    uint64_t now = timestamp_ticks();
+    deadline_handler_t handler;
+
+    while (m_count && (m_heap[0].due <= now)) {
+        handler = m_heap[0].handler;
+        m_heap[0].due += m_heap[0].period;
+        if (m_heap[0].due <= now) {
+            /* Missed whole periods, don't run them back to back. */
+            m_heap[0].due = now + m_heap[0].period;
+        }
+        heap_down(0);
+        handler();
+    }
+    deadline_arm(timestamp_ticks());
+}
+
+void deadline_init(void)
+{
+    m_count = 0;
+    APP_ERROR_CHECK(app_timer_create(&m_deadline_timer_id,
+        APP_TIMER_MODE_SINGLE_SHOT, deadline_timeout_handler));
+}
+
+int deadline_add(deadline_handler_t handler, uint32_t period_ms)
+{
+    uint64_t now;
+    uint32_t period = (uint32_t)MS_TO_TICKS(period_ms);
+
+    if ((m_count >= DEADLINE_MAX_TASKS) || !handler || !period) {
+        return -1;
+    }
+    now = timestamp_ticks();
+    m_heap[m_count].due = now + period;
+    m_heap[m_count].period = period;
+    m_heap[m_count].handler = handler;
+    heap_up(m_count);
+    m_count++;
+    deadline_arm(now);
+    return 0;
+}
+
+int deadline_set_period(deadline_handler_t handler, uint32_t period_ms)
+{
+    uint64_t now;
+    uint32_t period = (uint32_t)MS_TO_TICKS(period_ms);
+    uint8_t ii;
+
+    if (!period) {
+        return -1;
+    }
+    for (ii = 0; ii < m_count; ii++) {
+        if (m_heap[ii].handler == handler) {
+            break;
+        }
+    }
+    if (ii == m_count) {
+        return -1;
+    }
+    now = timestamp_ticks();
+    m_heap[ii].due = now + period;
+    m_heap[ii].period = period;
+    heap_up(ii);
+    heap_down(ii);
+    deadline_arm(now);
+    return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef __DEADLINE__
+#define __DEADLINE__
+
+#include <stdint.h>
+
+/* Periodic tasks run from a single app_timer, which is always set to the
+ * earliest deadline. Handlers run in the main loop (APP_TIMER_APPSH_INIT).
+ * Each deadline is advanced by its period, so the cadence doesn't depend on
+ * how late the handler runs or on what else wakes the CPU.
+ */
+
+#define DEADLINE_MAX_TASKS      (8)
+
+typedef void (*deadline_handler_t)(void);
+
+/* Must be called after the app_timer module is initialized. */
+void deadline_init(void);
+
+/* Run handler every period_ms, first one period from now. Returns -1 if the
+ * task table is full.
+ */
+int deadline_add(deadline_handler_t handler, uint32_t period_ms);
+
+/* Change the period of a task added with deadline_add, the next run is one
+ * new period from now. Returns -1 if the task is not found.
+ */
+int deadline_set_period(deadline_handler_t handler, uint32_t period_ms);
+
+#endif
@@ -0,0 +1,143 @@
+#include "latency.h"
+
+#if LATENCY_ENABLED
+
+#include <string.h>
+#include "nrf.h"
+#include "nrf_log.h"
+#include "timestamping.h"
+
+#define LATENCY_BUCKETS         (17)    /* up to 65 ms, the last one is open */
+#define CYCLES_PER_US           (SystemCoreClock / 1000000)
+/* One RTC tick, rounded up. */
+#define RTC_TICK_US             (31)
+
+typedef struct {
+    uint32_t buckets[LATENCY_BUCKETS];
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+} latency_histogram_t;
+
+static latency_histogram_t m_histograms[LATENCY_NUM_STAGES];
+
+static struct {
+    uint8_t active;
+    uint64_t start_ticks;
+    uint64_t mark_ticks;
+    uint32_t mark_cycles;
+} m_trace;
+
+static const char * const m_stage_names[LATENCY_NUM_STAGES] = {
+    "wake", "fifo", "build", "fusion", "output", "notify", "total"
+};
+
+static void histogram_add(latency_stage_t stage, uint32_t us)
+{
+    latency_histogram_t *hist = &m_histograms[stage];
+    uint8_t bucket = us ? (31 - __builtin_clz(us)) : 0;
+
+    if (bucket >= LATENCY_BUCKETS) {
+        bucket = LATENCY_BUCKETS - 1;
+    }
+    hist->buckets[bucket]++;
+    if (!hist->count || (us < hist->min_us)) {
+        hist->min_us = us;
+    }
+    if (us > hist->max_us) {
+        hist->max_us = us;
+    }
+    hist->count++;
+}
+
+static uint32_t histogram_percentile(latency_histogram_t const *hist,
+        uint8_t percent)
+{
+    uint32_t target = (hist->count * percent + 99) / 100;
+    uint32_t seen = 0;
+    uint8_t ii;
+
+    for (ii = 0; ii < LATENCY_BUCKETS; ii++) {
+        seen += hist->buckets[ii];
+        if (seen >= target) {
+            break;
+        }
+    }
+    if (ii >= LATENCY_BUCKETS - 1) {
+        return hist->max_us;
+    }
+    /* Upper bound of the bucket, or the max if it is lower. */
+    return ((2UL << ii) - 1 < hist->max_us) ? ((2UL << ii) - 1) : hist->max_us;
+}
+
+void latency_init(void)
+{
+    memset(m_histograms, 0, sizeof(m_histograms));
+    m_trace.active = 0;
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+void latency_start(uint64_t irq_ticks)
+{
+    m_trace.active = 1;
+    m_trace.start_ticks = irq_ticks;
+    m_trace.mark_ticks = irq_ticks;
+    /* No cycle count for the interrupt, the first stage is timed with the
+     * RTC.
+     */
+    m_trace.mark_cycles = DWT->CYCCNT;
+}
+
+void latency_mark(latency_stage_t stage)
+{
+    uint64_t ticks;
+    uint32_t cycles, rtc_us, cpu_us;
+
+    if (!m_trace.active) {
+        return;
+    }
+    ticks = timestamp_ticks();
+    cycles = DWT->CYCCNT;
+
+    rtc_us = (uint32_t)TIMESTAMP_TICKS_TO_US(ticks - m_trace.mark_ticks);
+    cpu_us = (cycles - m_trace.mark_cycles) / CYCLES_PER_US;
+    /* If the RTC saw more time pass than the CPU, the CPU slept. */
+    histogram_add(stage, ((stage == LATENCY_WAKE) ||
+        (rtc_us > cpu_us + RTC_TICK_US)) ? rtc_us : cpu_us);
+
+    m_trace.mark_ticks = ticks;
+    m_trace.mark_cycles = cycles;
+    if (stage == LATENCY_NOTIFY) {
+        histogram_add(LATENCY_TOTAL,
+            (uint32_t)TIMESTAMP_TICKS_TO_US(ticks - m_trace.start_ticks));
+        m_trace.active = 0;
+    }
+}
+
+void latency_get(latency_stage_t stage, latency_stats_t *stats)
+{
+    latency_histogram_t const *hist = &m_histograms[stage];
+
+    stats->count = hist->count;
+    stats->min_us = hist->min_us;
+    stats->max_us = hist->max_us;
+    stats->p50_us = hist->count ? histogram_percentile(hist, 50) : 0;
+    stats->p99_us = hist->count ? histogram_percentile(hist, 99) : 0;
+}
+
+void latency_log(void)
+{
+    latency_stats_t stats;
+    uint8_t ii;
+
+    for (ii = 0; ii < LATENCY_NUM_STAGES; ii++) {
+        latency_get((latency_stage_t)ii, &stats);
+        NRF_LOG_INFO("%s: n=%u min=%u p50=%u p99=%u max=%u us\r\n",
+            (uint32_t)m_stage_names[ii], stats.count, stats.min_us,
+            stats.p50_us, stats.p99_us, stats.max_us);
+    }
+}
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef __LATENCY__
+#define __LATENCY__
+
+#include <stdint.h>
+
+/* Latency of a sample through the pipeline, from the data ready interrupt
+ * to the BLE notification, kept per stage in log2 histograms. Build with
+ * -DLATENCY_ENABLED=1, otherwise the marks compile to nothing.
+ *
+ * Stages are timed with the DWT cycle counter. It stops while the CPU
+ * sleeps, so a stage that waited in sd_app_evt_wait (an I2C transfer, the
+ * main loop wake-up) is timed with the RTC instead.
+ */
+#ifndef LATENCY_ENABLED
+#define LATENCY_ENABLED         0
+#endif
+
+typedef enum {
+    LATENCY_WAKE = 0,       /* interrupt (drain timer when batching) to FIFO read started */
+    LATENCY_FIFO_READ,      /* FIFO transfer and scheduler */
+    LATENCY_BUILD,          /* decode and inv_build_*, earlier batch samples fused */
+    LATENCY_FUSION,         /* inv_execute_on_data */
+    LATENCY_OUTPUT,         /* MPL getters and output callback */
+    LATENCY_NOTIFY,         /* wait in notify_queue and sd_ble_gatts_hvx */
+    LATENCY_TOTAL,          /* interrupt to notification */
+    LATENCY_NUM_STAGES
+} latency_stage_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t p50_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+} latency_stats_t;
+
+#if LATENCY_ENABLED
+
+/* Starts the DWT cycle counter. */
+void latency_init(void);
+/* New trace, from the RTC time of the interrupt. An unfinished trace is
+ * dropped.
+ */
+void latency_start(uint64_t irq_ticks);
+/* End of a stage, the next one starts here. Ignored outside of a trace.
+ * LATENCY_NOTIFY ends the trace.
+ */
+void latency_mark(latency_stage_t stage);
+/* Percentiles are the upper bound of their histogram bucket. */
+void latency_get(latency_stage_t stage, latency_stats_t *stats);
+/* Print every stage to the log (RTT). */
+void latency_log(void);
+
+#define LATENCY_INIT()          latency_init()
+#define LATENCY_START(TICKS)    latency_start(TICKS)
+#define LATENCY_MARK(STAGE)     latency_mark(STAGE)
+
+#else
+
+#define LATENCY_INIT()
+#define LATENCY_START(TICKS)
+#define LATENCY_MARK(STAGE)
+
+#endif
+
+#endif
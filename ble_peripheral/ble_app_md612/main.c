@@ -51,6 +51,11 @@
 #include "ble_conn_state.h"
 
 #include "md612.h"
+#include "deadline.h"
+#include "latency.h"
+#include "profile.h"
+#include "notify_queue.h"
+#include "quat_codec.h"
 #include "app_twi.h"
 
 #define NRF_LOG_MODULE_NAME "MD612_BLE"
@@ -74,7 +79,10 @@
  * Bluetooth Defines
  */
 #if (NRF_SD_BLE_API_VERSION == 3)
-#define NRF_BLE_MAX_MTU_SIZE            GATT_MTU_SIZE_DEFAULT                      /**< MTU size used in the softdevice enabling and to reply to a BLE_GATTS_EVT_EXCHANGE_MTU_REQUEST event. */
+#define NRF_BLE_MAX_MTU_SIZE            247                                        /**< MTU size used in the softdevice enabling and to reply to a BLE_GATTS_EVT_EXCHANGE_MTU_REQUEST event. The largest the S132 supports. */
+#define NRF_BLE_MAX_PDU_SIZE            251                                        /**< LL data length requested with the data length extension, one MTU sized packet per PDU. */
+#else
+#define NRF_BLE_MAX_MTU_SIZE            GATT_MTU_SIZE_DEFAULT
 #endif
 
 #define IS_SRVC_CHANGED_CHARACT_PRESENT 1                                          /**< Include or not the service_changed characteristic. if not enabled, the server's database cannot be changed for the lifetime of the device*/
@@ -115,7 +123,7 @@
 
 #define SCHED_MAX_EVENT_DATA_SIZE       MAX(APP_TIMER_SCHED_EVT_SIZE, \
                                             BLE_STACK_HANDLER_SCHED_EVT_SIZE)         /**< Maximum size of scheduler events. */
-#define SCHED_QUEUE_SIZE                10                                            /**< Maximum number of events in the scheduler queue. */
+#define SCHED_QUEUE_SIZE                20                                            /**< Maximum number of events in the scheduler queue: the app, deadline, FIFO drain and keepalive timers, a burst of BLE events and the md612 TWI reads. */
 
 
 #define DEAD_BEEF                       0xDEADBEEF                                    /**< Value used as error code on stack dump, can be used to identify stack location on stack unwind. */
@@ -123,17 +131,79 @@
 #define BLE_UUID_BASE_UUID              {{0x23, 0xD1, 0x13, 0xEF, 0x5F, 0x78,  0x23, 0x15,0xDE, 0xEF,0x12, 0x12, 0x00, 0x00, 0x00, 0x00}} 			// 128-bit base UUID
 
 #define BLE_UUID_MDE_SERVICE_UUID			0xF00D // Just a random, but recognizable value
-#define BLE_UUID_X_CHARACTERISTC_UUID    	0xACCE
-#define BLE_UUID_Y_CHARACTERISTC_UUID    	0xBEEF
-#define BLE_UUID_Z_CHARACTERISTC_UUID 		0xCEEF
+#define BLE_UUID_FRAME_CHARACTERISTC_UUID 	0xDA7A  // packed motion frame
 #define BLE_UUID_YAWR_CHARACTERISTC_UUID 	0xDEEF  // reset Yaw Reset
+#define BLE_UUID_CTRL_CHARACTERISTC_UUID 	0xC0DE  // rates control point
+#define BLE_UUID_STATS_CHARACTERISTC_UUID 	0x57A7  // link and loss statistics
+
+/* Control point: opcode, then little-endian fields. SET_RATES carries the
+ * sample, DMP FIFO and compass rates in Hz (0 keeps the current one),
+ * followed by up to MD612_MAX_PUBLISH pairs of output type and publish
+ * divider, for the types motiondriver_callback handles: PACKET_DATA_QUAT
+ * and PACKET_DATA_LINEAR_ACCEL. DUMP_PROFILE has no fields and prints the cycle profile to the
+ * log when built with PROFILE_ENABLED. SET_TX_POLICY carries one of the
+ * NOTIFY_QUEUE_* policies. SET_STREAM carries one of the MDE_STREAM_* motion
+ * notification formats, frames until set.
+ */
+#define MDE_CTRL_OP_SET_RATES           	0x01
+#define MDE_CTRL_OP_DUMP_PROFILE        	0x02
+#define MDE_CTRL_OP_SET_TX_POLICY       	0x03
+#define MDE_CTRL_OP_SET_STREAM          	0x04
+#define MDE_CTRL_SET_RATES_LEN          	7
+#define MDE_CTRL_MAX_LEN                	(MDE_CTRL_SET_RATES_LEN + 2 * MD612_MAX_PUBLISH)
+
+/* Motion frame, one notification per fusion result. Fixed layout, all
+ * fields little-endian:
+ *   offset  0  uint16  sequence number, a gap means frames were lost
+ *   offset  2  uint32  sample timestamp (ms)
+ *   offset  6  int16   quaternion w, x, y, z in Q14 (1.0 = 16384)
+ *   offset 14  int16   linear acceleration x, y, z in mg, gravity removed
+ * 20 bytes, so it fits in one notification at the default ATT MTU. With a
+ * larger MTU, consecutive frames are sent back to back in one notification,
+ * as many as fit in the MTU and in MDE_BATCH_LATENCY_MS of samples.
+ */
+#define MDE_FRAME_SEQ_OFFSET            	0
+#define MDE_FRAME_TIMESTAMP_OFFSET      	2
+#define MDE_FRAME_QUAT_OFFSET           	6
+#define MDE_FRAME_ACCEL_OFFSET          	14
+#define MDE_FRAME_LEN                   	20
+#define MDE_BATCH_MAX_FRAMES            	((NRF_BLE_MAX_MTU_SIZE - 3) / MDE_FRAME_LEN)
+#define MDE_BATCH_LATENCY_MS            	20          /**< Longest a frame waits for the rest of its notification. */
+#define MDE_BATCH_LATENCY_TICKS         	APP_TIMER_TICKS(MDE_BATCH_LATENCY_MS, APP_TIMER_PRESCALER)
+#define MDE_TX_POLICY                   	NOTIFY_QUEUE_COALESCE   /**< Under congestion, send the latest orientation. */
+
+/* Motion notification formats. FRAMES is the layout above. COMPRESSED is a
+ * quat_codec block per notification, see quat_codec.h: a keyframe then
+ * delta coded samples, as many as fit in the MTU and in
+ * MDE_BATCH_LATENCY_MS. tools/mde_decode.py decodes both.
+ */
+#define MDE_STREAM_FRAMES               	0
+#define MDE_STREAM_COMPRESSED           	1
+
+/* Stats, read only, all fields little-endian, taken afresh on every read:
+ *   offset  0  uint32  samples produced (fusion results sent or not)
+ *   offset  4  uint32  notifications queued
+ *   offset  8  uint32  notifications sent
+ *   offset 12  uint32  notifications dropped, coalesced, refused or failed
+ *   offset 16  uint32  FIFO overflows
+ *   offset 20  uint32  FIFO packets lost to overflows and resets
+ *   offset 24  uint16  connection interval (1.25 ms units)
+ *   offset 26  uint16  ATT MTU
+ * Counters run from boot. The frame sequence numbers restart with each
+ * connection, the central compares them with the samples sent.
+ */
+#define MDE_STATS_LEN                   	28
 
 #define APP_FEATURE_NOT_SUPPORTED       	BLE_GATT_STATUS_ATTERR_APP_BEGIN + 2                      /**< Reply when unsupported features are requested. */
+#define APP_INVALID_RATES               	BLE_GATT_STATUS_ATTERR_APP_BEGIN + 3                      /**< Reply when a control point rate is out of range. */
+#define APP_INVALID_POLICY              	BLE_GATT_STATUS_ATTERR_APP_BEGIN + 4                      /**< Reply when a control point TX policy is unknown. */
+#define APP_INVALID_STREAM              	BLE_GATT_STATUS_ATTERR_APP_BEGIN + 5                      /**< Reply when a control point stream format is unknown. */
 
 /*
  * Battery BLE definitions
  */
 #define BATTERY_LEVEL_MEAS_INTERVAL     APP_TIMER_TICKS(2000, APP_TIMER_PRESCALER) /**< Battery level measurement interval (ticks). */
+#define TIMESTAMP_KEEPALIVE_INTERVAL    APP_TIMER_TICKS(TIMESTAMP_WRAP_MS / 2, APP_TIMER_PRESCALER) /**< The time base must be read at least once per RTC1 wrap (ticks). */
 #define MIN_BATTERY_LEVEL               81                                         /**< Minimum simulated battery level. */
 #define MAX_BATTERY_LEVEL               100                                        /**< Maximum simulated battery level. */
 #define BATTERY_LEVEL_INCREMENT         1                                          /**< Increment between each simulated battery level measurement. */
@@ -157,6 +227,9 @@
 #define MPU_INT_PIN                     10
 #endif
 
+#define LATENCY_LOG_MS                  10000                                      /**< Period of the latency histogram log when built with LATENCY_ENABLED (ms). */
+#define MPU_FIFO_BATCH_DEPTH            4                                          /**< Samples collected in the MPU FIFO per wake-up, 1 to wake up on every sample. */
+
 #ifdef NRF_LOG_BACKEND_SERIAL_USES_UART
 #define UART_TX_BUF_SIZE                256                                        /**< UART TX buffer size. */
 #define UART_RX_BUF_SIZE                1                                          /**< UART RX buffer size. */
@@ -169,10 +242,20 @@
 typedef struct {
 	uint16_t conn_handle; 						/**< Handle of the current connection (as provided by the BLE stack, is BLE_CONN_HANDLE_INVALID if not in a connection).*/
 	uint16_t service_handle; 					/**< Handle of ble Service (as provided by the BLE stack). */
-	ble_gatts_char_handles_t x_char_handles; 	/**< Handles related to the our new characteristic. */
-	ble_gatts_char_handles_t y_char_handles; 	/**< Handles related to the our new characteristic. */
-	ble_gatts_char_handles_t z_char_handles; 	/**< Handles related to the our new characteristic. */
-//DKW - add characteristics? Maybe change to qw,qx,qy,qz and ax, ay, az (or is there a better way?)
+	ble_gatts_char_handles_t frame_char_handles; /**< Handles related to the motion frame. */
+	ble_gatts_char_handles_t ctrl_char_handles; /**< Handles related to the rates control point. */
+	ble_gatts_char_handles_t stats_char_handles; /**< Handles related to the stats. */
+	uint32_t samples;							/**< Quaternions from the MPL, connected or not. */
+	uint16_t conn_interval;						/**< Connection interval (1.25 ms units). */
+	uint16_t frame_seq;							/**< Sequence number of the next motion frame. */
+	int16_t linear_accel[3];					/**< Latest linear acceleration (mg), sent with the next quaternion. */
+	uint16_t mtu;								/**< Negotiated ATT MTU. */
+	uint8_t batch_frames;						/**< Frames per notification, see ble_mde_batch_frames. */
+	uint8_t batch_count;						/**< Frames waiting in batch. */
+	uint32_t last_frame_ms;						/**< Timestamp of the last frame, for the frame period. */
+	uint8_t stream;								/**< One of MDE_STREAM_*. */
+	quat_codec_t codec;							/**< Block of the next notification in COMPRESSED. */
+	uint8_t batch[MDE_BATCH_MAX_FRAMES * MDE_FRAME_LEN];	/**< Frames or block of the next notification. */
 } ble_mde_t;
 
 static ble_mde_t m_mde; 						/**< MDE BLE Information. */
@@ -191,6 +274,8 @@ static sensorsim_cfg_t m_battery_sim_cfg; 									/**< Battery Level sensor sim
 static sensorsim_state_t m_battery_sim_state; 								/**< Battery Level sensor simulator state. */
 
 APP_TIMER_DEF(m_battery_timer_id); 											/**< Battery timer. */
+APP_TIMER_DEF(m_timestamp_timer_id); 										/**< Time base keepalive timer. */
+APP_TIMER_DEF(m_batch_timer_id); 											/**< Sends a partial motion batch. */
 
 /*
  * twi interface variables
@@ -201,10 +286,18 @@ app_twi_t m_app_twi = APP_TWI_INSTANCE(0);
 static void motiondriver_callback(unsigned char type, long *data,
 		int8_t accuracy, unsigned long timestamp);
 
+// call back function used by the MD612 before the sensors sleep.
+static void motiondriver_idle_callback(void);
+
+// timer handler sending a partial motion batch.
+static void batch_timeout_handler(void * p_context);
+
 // Pulled out of function has to exist even after fucntion exits.
 static platform_data_t const platform_data = {
 		.pin = MPU_INT_PIN,
 		.cb = motiondriver_callback,
+		.idle_cb = motiondriver_idle_callback,
+		.cb_types = (1 << PACKET_DATA_QUAT) | (1 << PACKET_DATA_LINEAR_ACCEL),
 
 /* The sensors can be mounted onto the board in any orientation. The mounting
  * matrix seen below tells the MPL how to rotate the raw data from the
@@ -472,6 +565,16 @@ static void battery_level_meas_timeout_handler(void * p_context) {
 	battery_level_update();
 }
 
+/**@brief Function for handling the time base keepalive timer timeout.
+ *
+ * @details Reads the time base so RTC1 wraps are never missed, even when no
+ *          sensor data comes in. The timer also keeps RTC1 running.
+ */
+static void timestamp_keepalive_timeout_handler(void * p_context) {
+	UNUSED_PARAMETER(p_context);
+	(void)timestamp_ticks();
+}
+
 /**@brief Function for the Timer initialization.
  *
  * @details Initializes the timer module.
@@ -486,6 +589,22 @@ static void timers_init(void) {
 	err_code = app_timer_create(&m_battery_timer_id, APP_TIMER_MODE_REPEATED,
 			battery_level_meas_timeout_handler);
 	APP_ERROR_CHECK(err_code);
+
+	// Create time base keepalive timer.
+	err_code = app_timer_create(&m_timestamp_timer_id, APP_TIMER_MODE_REPEATED,
+			timestamp_keepalive_timeout_handler);
+	APP_ERROR_CHECK(err_code);
+
+	// Create motion batch timer.
+	err_code = app_timer_create(&m_batch_timer_id, APP_TIMER_MODE_SINGLE_SHOT,
+			batch_timeout_handler);
+	APP_ERROR_CHECK(err_code);
+
+	// Periodic motion driver tasks.
+	deadline_init();
+#if LATENCY_ENABLED
+	APP_ERROR_CHECK(deadline_add(latency_log, LATENCY_LOG_MS));
+#endif
 }
 
 /**@brief Function for the GAP initialization.
@@ -554,8 +673,8 @@ static uint32_t ble_char_mde_add(ble_mde_t * p_mde) {
 
 	ble_uuid128_t base_uuid = BLE_UUID_BASE_UUID;
 
-	// setup the 1st characteristic UUID.
-	BLE_UUID_BLE_ASSIGN(char_uuid, BLE_UUID_X_CHARACTERISTC_UUID);
+	// setup the motion frame characteristic UUID.
+	BLE_UUID_BLE_ASSIGN(char_uuid, BLE_UUID_FRAME_CHARACTERISTC_UUID);
 	sd_ble_uuid_vs_add(&base_uuid, &char_uuid.type);
 	APP_ERROR_CHECK(err_code);
 
@@ -566,22 +685,22 @@ static uint32_t ble_char_mde_add(ble_mde_t * p_mde) {
 	attr_md.vloc = BLE_GATTS_VLOC_STACK;  // store information in stack other option (BLE_GATTS_VLOC_USER)
 
 	BLE_GAP_CONN_SEC_MODE_SET_OPEN(&attr_md.read_perm);
-	BLE_GAP_CONN_SEC_MODE_SET_OPEN(&attr_md.write_perm);
+	BLE_GAP_CONN_SEC_MODE_SET_NO_ACCESS(&attr_md.write_perm);
 
 	// Configure the charateristic value attribute - contains the actual value..
 	ble_gatts_attr_t attr_char_value;
 	memset(&attr_char_value, 0, sizeof(attr_char_value));
 	attr_char_value.p_uuid = &char_uuid;
 	attr_char_value.p_attr_md = &attr_md;
-	attr_char_value.max_len = sizeof (int16_t);
-	attr_char_value.init_len = sizeof (int16_t);
-	uint8_t value[2] = { 1 };                   // just for testing set to 1.
+	attr_md.vlen = 1;
+	attr_char_value.max_len = sizeof(p_mde->batch);
+	attr_char_value.init_len = MDE_FRAME_LEN;
+	uint8_t value[MDE_FRAME_LEN] = { 0 };
 	attr_char_value.p_value = value;
 
 	ble_gatts_char_md_t char_md;
 	memset(&char_md, 0, sizeof(char_md));
 	char_md.char_props.read = 1;
-	char_md.char_props.write = 1;
 
 	// setup the attribute metadata for charaterictic
 	ble_gatts_attr_md_t cccd_md;
@@ -592,31 +711,45 @@ static uint32_t ble_char_mde_add(ble_mde_t * p_mde) {
 	char_md.p_cccd_md = &cccd_md;
 	char_md.char_props.notify = 1;
 
-	// Add up X characteristic
+	// Add up the motion frame characteristic
 	err_code = sd_ble_gatts_characteristic_add(p_mde->service_handle, &char_md,
-			&attr_char_value, &p_mde->x_char_handles);
+			&attr_char_value, &p_mde->frame_char_handles);
 	APP_ERROR_CHECK(err_code);
 
-	// setup the Y characteristic UUID.
-	BLE_UUID_BLE_ASSIGN(char_uuid, BLE_UUID_Y_CHARACTERISTC_UUID);
+	// setup the control point, write only. Writes are authorized so a bad
+	// request gets an error back.
+	BLE_UUID_BLE_ASSIGN(char_uuid, BLE_UUID_CTRL_CHARACTERISTC_UUID);
 	sd_ble_uuid_vs_add(&base_uuid, &char_uuid.type);
-	APP_ERROR_CHECK(err_code);
-	// add up Y characteristic
-	value[0] = 2;
-	value[1] = 2;  // just for testing set to 2.
+	attr_md.vlen = 1;
+	attr_md.wr_auth = 1;
+	BLE_GAP_CONN_SEC_MODE_SET_NO_ACCESS(&attr_md.read_perm);
+	BLE_GAP_CONN_SEC_MODE_SET_OPEN(&attr_md.write_perm);
+	attr_char_value.init_len = 0;
+	attr_char_value.max_len = MDE_CTRL_MAX_LEN;
+	attr_char_value.p_value = NULL;
+	memset(&char_md, 0, sizeof(char_md));
+	char_md.char_props.write = 1;
 	err_code = sd_ble_gatts_characteristic_add(p_mde->service_handle, &char_md,
-				&attr_char_value, &p_mde->y_char_handles);
+				&attr_char_value, &p_mde->ctrl_char_handles);
 	APP_ERROR_CHECK(err_code);
 
-	// setup the Z characteristic UUID.
-	BLE_UUID_BLE_ASSIGN(char_uuid, BLE_UUID_Z_CHARACTERISTC_UUID);
+	// setup the stats, read only. Reads are authorized so the values can
+	// be filled in when asked for.
+	BLE_UUID_BLE_ASSIGN(char_uuid, BLE_UUID_STATS_CHARACTERISTC_UUID);
 	sd_ble_uuid_vs_add(&base_uuid, &char_uuid.type);
-	APP_ERROR_CHECK(err_code);
-	value[0] = 3;                   // just for testing set to 3.
-	value[1] = 3;
-	// add up Y characteristic
+	attr_md.vlen = 0;
+	attr_md.wr_auth = 0;
+	attr_md.rd_auth = 1;
+	BLE_GAP_CONN_SEC_MODE_SET_OPEN(&attr_md.read_perm);
+	BLE_GAP_CONN_SEC_MODE_SET_NO_ACCESS(&attr_md.write_perm);
+	uint8_t stats[MDE_STATS_LEN] = { 0 };
+	attr_char_value.init_len = MDE_STATS_LEN;
+	attr_char_value.max_len = MDE_STATS_LEN;
+	attr_char_value.p_value = stats;
+	memset(&char_md, 0, sizeof(char_md));
+	char_md.char_props.read = 1;
 	err_code = sd_ble_gatts_characteristic_add(p_mde->service_handle, &char_md,
-				&attr_char_value, &p_mde->z_char_handles);
+				&attr_char_value, &p_mde->stats_char_handles);
 	APP_ERROR_CHECK(err_code);
 
 	return NRF_SUCCESS;
@@ -710,6 +843,10 @@ static void timers_start(void) {
 	err_code = app_timer_start(m_battery_timer_id, BATTERY_LEVEL_MEAS_INTERVAL,
 			NULL);
 	APP_ERROR_CHECK(err_code);
+
+	err_code = app_timer_start(m_timestamp_timer_id, TIMESTAMP_KEEPALIVE_INTERVAL,
+			NULL);
+	APP_ERROR_CHECK(err_code);
 }
 
 /**@brief Function for putting the chip into sleep mode.
@@ -828,6 +965,137 @@ static void on_adv_evt(ble_adv_evt_t ble_adv_evt) {
 	}
 }
 
+/**@brief Function for choosing the number of frames per notification.
+ *
+ * @details As many as fit in the MTU, but no more than MDE_BATCH_LATENCY_MS
+ *          of samples so the first frame isn't held back too long.
+ *
+ * @param[in]   p_mde       mde structure.
+ * @param[in]   period_ms   Time between frames, 0 if not known yet.
+ */
+static uint8_t ble_mde_batch_frames(ble_mde_t *p_mde, uint32_t period_ms)
+{
+	uint32_t frames = (p_mde->mtu - 3) / MDE_FRAME_LEN;
+
+	if (frames > MDE_BATCH_MAX_FRAMES) {
+		frames = MDE_BATCH_MAX_FRAMES;
+	}
+	if (period_ms && ((MDE_BATCH_LATENCY_MS / period_ms) < frames)) {
+		frames = MDE_BATCH_LATENCY_MS / period_ms;
+	}
+	return frames ? frames : 1;
+}
+
+/**@brief Function for handling the end of an MTU exchange.
+ *
+ * @param[in]   p_mde       mde structure.
+ * @param[in]   peer_mtu    MTU of the peer.
+ */
+static void ble_mde_on_mtu(ble_mde_t *p_mde, uint16_t peer_mtu)
+{
+	p_mde->mtu = MIN(peer_mtu, NRF_BLE_MAX_MTU_SIZE);
+	if (p_mde->mtu < GATT_MTU_SIZE_DEFAULT) {
+		p_mde->mtu = GATT_MTU_SIZE_DEFAULT;
+	}
+	NRF_LOG_INFO("MTU %u, up to %u frames per notification\r\n", p_mde->mtu,
+			ble_mde_batch_frames(p_mde, 0));
+}
+
+/**@brief Function for encoding the stats characteristic value.
+ *
+ * @param[in]   p_mde       mde structure.
+ * @param[out]  p_stats     MDE_STATS_LEN bytes.
+ */
+static void ble_mde_stats_encode(ble_mde_t const * p_mde, uint8_t * p_stats) {
+	notify_queue_stats_t queue;
+	unsigned long overflows, lost, resets, resyncs;
+
+	notify_queue_get_stats(&queue);
+	md612_get_fifo_stats(&overflows, &lost, &resets, &resyncs);
+
+	uint32_encode(p_mde->samples, &p_stats[0]);
+	uint32_encode(queue.queued, &p_stats[4]);
+	uint32_encode(queue.sent, &p_stats[8]);
+	uint32_encode(queue.dropped + queue.coalesced + queue.blocked + queue.failed,
+			&p_stats[12]);
+	uint32_encode(overflows, &p_stats[16]);
+	uint32_encode(lost, &p_stats[20]);
+	uint16_encode(p_mde->conn_interval, &p_stats[24]);
+	uint16_encode(p_mde->mtu, &p_stats[26]);
+}
+
+/**@brief Function for handling a write to the rates control point.
+ *
+ * @param[in]   p_data   Written value.
+ * @param[in]   len      Length of the written value.
+ *
+ * @return      GATT status to reply with.
+ */
+static uint16_t ble_mde_on_ctrl_write(uint8_t const * p_data, uint16_t len) {
+	md612_rates_t rates;
+	uint32_t err_code;
+	uint8_t i;
+
+#if PROFILE_ENABLED
+	if ((len == 1) && (p_data[0] == MDE_CTRL_OP_DUMP_PROFILE)) {
+		profile_dump();
+		return BLE_GATT_STATUS_SUCCESS;
+	}
+#endif
+	if ((len >= 1) && (p_data[0] == MDE_CTRL_OP_SET_TX_POLICY)) {
+		if (len != 2) {
+			return BLE_GATT_STATUS_ATTERR_INVALID_ATT_VAL_LENGTH;
+		}
+		if (p_data[1] > NOTIFY_QUEUE_BLOCK) {
+			return APP_INVALID_POLICY;
+		}
+		notify_queue_set_policy(p_data[1]);
+		NRF_LOG_INFO("TX policy %u\r\n", p_data[1]);
+		return BLE_GATT_STATUS_SUCCESS;
+	}
+	if ((len >= 1) && (p_data[0] == MDE_CTRL_OP_SET_STREAM)) {
+		if (len != 2) {
+			return BLE_GATT_STATUS_ATTERR_INVALID_ATT_VAL_LENGTH;
+		}
+		if (p_data[1] > MDE_STREAM_COMPRESSED) {
+			return APP_INVALID_STREAM;
+		}
+		if (p_data[1] != m_mde.stream) {
+			// Drop what was batched in the old format.
+			err_code = app_timer_stop(m_batch_timer_id);
+			APP_ERROR_CHECK(err_code);
+			m_mde.batch_count = 0;
+			m_mde.codec.count = 0;
+			m_mde.stream = p_data[1];
+		}
+		NRF_LOG_INFO("Stream %u\r\n", p_data[1]);
+		return BLE_GATT_STATUS_SUCCESS;
+	}
+	if ((len < 1) || (p_data[0] != MDE_CTRL_OP_SET_RATES)) {
+		return APP_FEATURE_NOT_SUPPORTED;
+	}
+	if ((len < MDE_CTRL_SET_RATES_LEN) || (len > MDE_CTRL_MAX_LEN)
+			|| ((len - MDE_CTRL_SET_RATES_LEN) & 1)) {
+		return BLE_GATT_STATUS_ATTERR_INVALID_ATT_VAL_LENGTH;
+	}
+
+	rates.sample_hz = uint16_decode(&p_data[1]);
+	rates.fifo_hz = uint16_decode(&p_data[3]);
+	rates.compass_hz = uint16_decode(&p_data[5]);
+	rates.publish_count = (len - MDE_CTRL_SET_RATES_LEN) / 2;
+	for (i = 0; i < rates.publish_count; i++) {
+		rates.publish[i].type = p_data[MDE_CTRL_SET_RATES_LEN + 2 * i];
+		rates.publish[i].divider = p_data[MDE_CTRL_SET_RATES_LEN + 2 * i + 1];
+	}
+
+	if (md612_set_rates(&rates)) {
+		return APP_INVALID_RATES;
+	}
+	NRF_LOG_INFO("Rates: sample %u Hz, fifo %u Hz, compass %u Hz\r\n",
+			rates.sample_hz, rates.fifo_hz, rates.compass_hz);
+	return BLE_GATT_STATUS_SUCCESS;
+}
+
 /**@brief Function for handling the Application's BLE Stack events.
  *
  * @param[in]   p_ble_evt   Bluetooth stack event.
@@ -842,8 +1110,29 @@ static void on_ble_evt(ble_evt_t * p_ble_evt) {
 		APP_ERROR_CHECK(err_code);
 
 		m_mde.conn_handle = p_ble_evt->evt.gap_evt.conn_handle;
+		m_mde.conn_interval =
+				p_ble_evt->evt.gap_evt.params.connected.conn_params.max_conn_interval;
+		m_mde.frame_seq = 0;
+		m_mde.batch_count = 0;
+		m_mde.codec.count = 0;
+		m_mde.stream = MDE_STREAM_FRAMES;
+		m_mde.mtu = GATT_MTU_SIZE_DEFAULT;
+#if (NRF_SD_BLE_API_VERSION == 3)
+		// Ask for the largest MTU right away, the central may not. Busy if
+		// the central asked first, its request sets the MTU then.
+		err_code = sd_ble_gattc_exchange_mtu_request(m_mde.conn_handle,
+				NRF_BLE_MAX_MTU_SIZE);
+		if (err_code != NRF_SUCCESS) {
+			NRF_LOG_INFO("MTU request: %u\r\n", err_code);
+		}
+#endif
 		break; // BLE_GAP_EVT_CONNECTED
 
+	case BLE_GAP_EVT_CONN_PARAM_UPDATE:
+		m_mde.conn_interval =
+				p_ble_evt->evt.gap_evt.params.conn_param_update.conn_params.max_conn_interval;
+		break; // BLE_GAP_EVT_CONN_PARAM_UPDATE
+
 	case BLE_GAP_EVT_DISCONNECTED:
 		NRF_LOG_INFO("Disconnected\r\n");
 		err_code = bsp_indication_set(BSP_INDICATE_IDLE);
@@ -894,7 +1183,44 @@ static void on_ble_evt(ble_evt_t * p_ble_evt) {
 
 		req = p_ble_evt->evt.gatts_evt.params.authorize_request;
 
-		if (req.type != BLE_GATTS_AUTHORIZE_TYPE_INVALID) {
+		if ((req.type == BLE_GATTS_AUTHORIZE_TYPE_WRITE)
+				&& (req.request.write.op == BLE_GATTS_OP_WRITE_REQ)
+				&& (req.request.write.handle == m_mde.ctrl_char_handles.value_handle)) {
+			// The copy in req only holds the first byte of the data.
+			ble_gatts_evt_write_t const * p_write =
+					&p_ble_evt->evt.gatts_evt.params.authorize_request.request.write;
+
+			memset(&auth_reply, 0, sizeof(auth_reply));
+			auth_reply.type = BLE_GATTS_AUTHORIZE_TYPE_WRITE;
+			auth_reply.params.write.gatt_status =
+					ble_mde_on_ctrl_write(p_write->data, p_write->len);
+			if (auth_reply.params.write.gatt_status == BLE_GATT_STATUS_SUCCESS) {
+				auth_reply.params.write.update = 1;
+				auth_reply.params.write.len = p_write->len;
+				auth_reply.params.write.p_data = p_write->data;
+			}
+			err_code = sd_ble_gatts_rw_authorize_reply(
+					p_ble_evt->evt.gatts_evt.conn_handle, &auth_reply);
+			APP_ERROR_CHECK(err_code);
+		} else if ((req.type == BLE_GATTS_AUTHORIZE_TYPE_READ)
+				&& (req.request.read.handle == m_mde.stats_char_handles.value_handle)) {
+			uint8_t stats[MDE_STATS_LEN];
+
+			memset(&auth_reply, 0, sizeof(auth_reply));
+			auth_reply.type = BLE_GATTS_AUTHORIZE_TYPE_READ;
+			auth_reply.params.read.gatt_status = BLE_GATT_STATUS_SUCCESS;
+			// A new snapshot for each read, the rest of a long read is
+			// served from the stored value.
+			if (req.request.read.offset == 0) {
+				ble_mde_stats_encode(&m_mde, stats);
+				auth_reply.params.read.update = 1;
+				auth_reply.params.read.len = MDE_STATS_LEN;
+				auth_reply.params.read.p_data = stats;
+			}
+			err_code = sd_ble_gatts_rw_authorize_reply(
+					p_ble_evt->evt.gatts_evt.conn_handle, &auth_reply);
+			APP_ERROR_CHECK(err_code);
+		} else if (req.type != BLE_GATTS_AUTHORIZE_TYPE_INVALID) {
 			if ((req.request.write.op == BLE_GATTS_OP_PREP_WRITE_REQ)
 					|| (req.request.write.op == BLE_GATTS_OP_EXEC_WRITE_REQ_NOW)
 					|| (req.request.write.op
@@ -918,7 +1244,14 @@ static void on_ble_evt(ble_evt_t * p_ble_evt) {
 		err_code = sd_ble_gatts_exchange_mtu_reply(p_ble_evt->evt.gatts_evt.conn_handle,
 				NRF_BLE_MAX_MTU_SIZE);
 		APP_ERROR_CHECK(err_code);
+		ble_mde_on_mtu(&m_mde,
+				p_ble_evt->evt.gatts_evt.params.exchange_mtu_request.client_rx_mtu);
 		break; // BLE_GATTS_EVT_EXCHANGE_MTU_REQUEST
+
+		case BLE_GATTC_EVT_EXCHANGE_MTU_RSP:
+		ble_mde_on_mtu(&m_mde,
+				p_ble_evt->evt.gattc_evt.params.exchange_mtu_rsp.server_rx_mtu);
+		break; // BLE_GATTC_EVT_EXCHANGE_MTU_RSP
 #endif
 		case BLE_GATTS_EVT_WRITE:{
 			ble_gatts_evt_write_t * p_evt_write = &p_ble_evt->evt.gatts_evt.params.write;
@@ -933,14 +1266,6 @@ static void on_ble_evt(ble_evt_t * p_ble_evt) {
 
 			//value = uint16_decode(&p_evt_write->data[0]);
 			switch (p_evt_write->uuid.uuid) {
-			case BLE_UUID_X_CHARACTERISTC_UUID:
-				    //NRF_LOG_INFO("on_ble_evt X uuid=0x%04, len=%u data=0x%04x \r\n",p_evt_write->uuid.uuid, p_evt_write->op, p_evt_write->len, value]);
-
-				break;
-			case BLE_UUID_Y_CHARACTERISTC_UUID:
-
-			case BLE_UUID_Z_CHARACTERISTC_UUID:
-
 			case BLE_UUID_YAWR_CHARACTERISTC_UUID:
 				break;
 			default:
@@ -973,6 +1298,7 @@ static void ble_evt_dispatch(ble_evt_t * p_ble_evt) {
 	pm_on_ble_evt(p_ble_evt);
 	bsp_btn_ble_on_ble_evt(p_ble_evt);
 	on_ble_evt(p_ble_evt);
+	notify_queue_on_ble_evt(p_ble_evt);
 	ble_advertising_on_ble_evt(p_ble_evt);
 	ble_conn_params_on_ble_evt(p_ble_evt);
 	ble_bas_on_ble_evt(&m_bas, p_ble_evt);
@@ -1017,11 +1343,41 @@ static void ble_stack_init(void) {
 
 	// Enable BLE stack.
 #if (NRF_SD_BLE_API_VERSION == 3)
+	// High bandwidth: more packets per connection event for the one link.
+	ble_conn_bw_counts_t conn_bw_counts = {
+		.tx_counts = {.high_count = 1, .mid_count = 0, .low_count = 0},
+		.rx_counts = {.high_count = 1, .mid_count = 0, .low_count = 0}
+	};
+	ble_enable_params.common_enable_params.p_conn_bw_counts = &conn_bw_counts;
 	ble_enable_params.gatt_enable_params.att_mtu = NRF_BLE_MAX_MTU_SIZE;
 #endif
 	err_code = softdevice_enable(&ble_enable_params);
 	APP_ERROR_CHECK(err_code);
 
+#if (NRF_SD_BLE_API_VERSION == 3)
+	ble_opt_t opt;
+
+	memset(&opt, 0, sizeof(opt));
+	opt.common_opt.conn_bw.role = BLE_GAP_ROLE_PERIPH;
+	opt.common_opt.conn_bw.conn_bw.conn_bw_rx = BLE_CONN_BW_HIGH;
+	opt.common_opt.conn_bw.conn_bw.conn_bw_tx = BLE_CONN_BW_HIGH;
+	err_code = sd_ble_opt_set(BLE_COMMON_OPT_CONN_BW, &opt);
+	APP_ERROR_CHECK(err_code);
+
+	// LL data length extension, so an MTU sized notification goes out in
+	// one PDU instead of being fragmented into 27 byte ones.
+	memset(&opt, 0, sizeof(opt));
+	opt.gap_opt.ext_len.rxtx_max_pdu_payload_size = NRF_BLE_MAX_PDU_SIZE;
+	err_code = sd_ble_opt_set(BLE_GAP_OPT_EXT_LEN, &opt);
+	APP_ERROR_CHECK(err_code);
+
+	// Let connection events run on while there is data to send.
+	memset(&opt, 0, sizeof(opt));
+	opt.common_opt.conn_evt_ext.enable = 1;
+	err_code = sd_ble_opt_set(BLE_COMMON_OPT_CONN_EVT_EXT, &opt);
+	APP_ERROR_CHECK(err_code);
+#endif
+
 	// Register with the SoftDevice handler module for BLE events.
 	err_code = softdevice_ble_evt_handler_set(ble_evt_dispatch);
 	APP_ERROR_CHECK(err_code);
@@ -1110,39 +1466,121 @@ static void scheduler_init(void) {
 	APP_SCHED_INIT(SCHED_MAX_EVENT_DATA_SIZE, SCHED_QUEUE_SIZE);
 }
 
-static void ble_mde_update(ble_mde_t *p_mde, int16_t* x, int16_t* y, int16_t* z)
+static void ble_mde_update(ble_mde_t *p_mde, uint8_t *p_data, uint16_t len)
 {
     // Send value if connected and notifying
     if (p_mde->conn_handle != BLE_CONN_HANDLE_INVALID)
     {
-        uint16_t      len = sizeof(int16_t);
-        ble_gatts_hvx_params_t hvx_params;
-        memset(&hvx_params, 0, sizeof(hvx_params));
-
-        hvx_params.handle = p_mde->x_char_handles.value_handle;
-        hvx_params.type   = BLE_GATT_HVX_NOTIFICATION;
-        hvx_params.offset = 0;
-        hvx_params.p_len  = &len;
-        hvx_params.p_data = (uint8_t*) x;
-        sd_ble_gatts_hvx(p_mde->conn_handle, &hvx_params);
-
-        hvx_params.handle = p_mde->y_char_handles.value_handle;
-		hvx_params.type   = BLE_GATT_HVX_NOTIFICATION;
-		hvx_params.offset = 0;
-		hvx_params.p_len  = &len;
-		hvx_params.p_data = (uint8_t*) y;
-		sd_ble_gatts_hvx(p_mde->conn_handle, &hvx_params);
-
-		hvx_params.handle = p_mde->z_char_handles.value_handle;
-		hvx_params.type   = BLE_GATT_HVX_NOTIFICATION;
-		hvx_params.offset = 0;
-		hvx_params.p_len  = &len;
-		hvx_params.p_data = (uint8_t*) z;
-		sd_ble_gatts_hvx(p_mde->conn_handle, &hvx_params);
+        LATENCY_MARK(LATENCY_OUTPUT);
+        // Queued if the SoftDevice is out of TX buffers, see notify_queue.h.
+        // LATENCY_NOTIFY is marked once it is handed to the SoftDevice.
+        notify_queue_send(p_mde->frame_char_handles.value_handle, p_data, len);
 
     }
 }
 
+/**@brief Function for sending the motion frames or the compressed block
+ *        batched so far.
+ *
+ * @param[in]   p_mde        mde structure.
+ */
+static void ble_mde_flush(ble_mde_t *p_mde)
+{
+	uint32_t err_code;
+
+	// Only started for batches of more than one frame.
+	if (p_mde->batch_frames > 1) {
+		err_code = app_timer_stop(m_batch_timer_id);
+		APP_ERROR_CHECK(err_code);
+	}
+	if (p_mde->stream == MDE_STREAM_COMPRESSED) {
+		if (p_mde->codec.count) {
+			ble_mde_update(p_mde, p_mde->batch, p_mde->codec.len);
+			p_mde->codec.count = 0;
+		}
+	} else if (p_mde->batch_count) {
+		ble_mde_update(p_mde, p_mde->batch, p_mde->batch_count * MDE_FRAME_LEN);
+		p_mde->batch_count = 0;
+	}
+}
+
+/**@brief Function for queuing a motion frame, sent once the batch is full
+ *        or MDE_BATCH_LATENCY_MS after the first frame.
+ *
+ * @param[in]   p_mde        mde structure.
+ * @param[in]   p_frame      MDE_FRAME_LEN bytes.
+ * @param[in]   timestamp    Frame timestamp (ms).
+ */
+static void ble_mde_frame_add(ble_mde_t *p_mde, uint8_t const *p_frame, uint32_t timestamp)
+{
+	uint32_t err_code;
+
+	if (!p_mde->batch_count) {
+		// The MTU or the publish rate may have changed since the last batch.
+		p_mde->batch_frames = ble_mde_batch_frames(p_mde,
+				p_mde->last_frame_ms ? (timestamp - p_mde->last_frame_ms) : 0);
+		if (p_mde->batch_frames > 1) {
+			// Frames may stop or slow down before the batch is full.
+			err_code = app_timer_start(m_batch_timer_id, MDE_BATCH_LATENCY_TICKS, NULL);
+			APP_ERROR_CHECK(err_code);
+		}
+	}
+	p_mde->last_frame_ms = timestamp;
+	memcpy(&p_mde->batch[p_mde->batch_count * MDE_FRAME_LEN], p_frame, MDE_FRAME_LEN);
+	p_mde->batch_count++;
+	if (p_mde->batch_count >= p_mde->batch_frames) {
+		ble_mde_flush(p_mde);
+	}
+}
+
+/**@brief Function for handling the motion batch timer timeout.
+ *
+ * @param[in]   p_context   Not used.
+ */
+static void batch_timeout_handler(void * p_context) {
+	UNUSED_PARAMETER(p_context);
+	ble_mde_flush(&m_mde);
+}
+
+/**@brief Function for adding a sample to the compressed block, sent once
+ *        the block is full or MDE_BATCH_LATENCY_MS after its keyframe.
+ *
+ * @param[in]   p_mde        mde structure.
+ * @param[in]   p_quat       Quaternion w, x, y, z in Q14.
+ * @param[in]   timestamp    Sample timestamp (ms).
+ */
+static void ble_mde_compressed_add(ble_mde_t *p_mde, int16_t const *p_quat, uint32_t timestamp)
+{
+	uint16_t size = MIN(p_mde->mtu - 3, sizeof(p_mde->batch));
+	uint32_t period_ms = p_mde->last_frame_ms ? (timestamp - p_mde->last_frame_ms) : 0;
+	uint32_t err_code;
+
+	if (p_mde->codec.count && quat_codec_add(&p_mde->codec, p_mde->frame_seq,
+			timestamp, p_quat, p_mde->linear_accel)) {
+		// Out of room, the sample starts the next block.
+		ble_mde_flush(p_mde);
+	}
+	if (!p_mde->codec.count) {
+		// The MTU bounds the block by bytes, the latency budget by samples.
+		p_mde->batch_frames = (period_ms && (period_ms < MDE_BATCH_LATENCY_MS)) ?
+				MIN(MDE_BATCH_LATENCY_MS / period_ms, 0xFF) : 1;
+		quat_codec_init(&p_mde->codec, p_mde->batch, size);
+		// A keyframe always fits.
+		quat_codec_add(&p_mde->codec, p_mde->frame_seq, timestamp, p_quat,
+				p_mde->linear_accel);
+		if (p_mde->batch_frames > 1) {
+			// Samples may stop or slow down before the block is full.
+			err_code = app_timer_start(m_batch_timer_id, MDE_BATCH_LATENCY_TICKS, NULL);
+			APP_ERROR_CHECK(err_code);
+		}
+	}
+	p_mde->last_frame_ms = timestamp;
+	p_mde->frame_seq++;
+	if (p_mde->codec.count >= p_mde->batch_frames) {
+		ble_mde_flush(p_mde);
+	}
+}
+
 /**@brief Function for handling events from the BSP module.
  *
  * @param[in]   event   Event generated by button press.
@@ -1207,76 +1645,52 @@ static void power_manage(void) {
 
 	APP_ERROR_CHECK(err_code);
 }
-/**@brief Function for when the euler need to be sent BLE.
+/**@brief Function for when the motion data need to be sent BLE.
+ *
+ * @details The linear acceleration is kept and sent in the frame of the next
+ *          quaternion. Both come from the same fusion step as long as the
+ *          linear acceleration is subscribed first, see motiondriver_init.
  */
 static void motiondriver_callback(unsigned char type, long *data,int8_t accuracy, unsigned long timestamp) {
-
+	uint8_t frame[MDE_FRAME_LEN];
+	int16_t quat[4];
+	int64_t mg;
+	uint8_t i;
 
 	switch (type) {
 
-//DKW - Commenting Out to Test Accel & Quat
-//	case PACKET_DATA_EULER: {
-//		int16_t x = inv_q16_to_float(data[0]);
-//		int16_t y = inv_q16_to_float(data[1]);
-//		int16_t z = inv_q16_to_float(data[2]);
-//
-//		//if (ble_conn_state_encrypted(m_mde.conn_handle) ) {
-//		if (ble_conn_state_status(m_mde.conn_handle) == BLE_CONN_STATUS_CONNECTED) {
-//			NRF_LOG_INFO("Euler: [" NRF_LOG_FLOAT_MARKER " " NRF_LOG_FLOAT_MARKER " " NRF_LOG_FLOAT_MARKER "]\r\n", NRF_LOG_FLOAT(x), NRF_LOG_FLOAT(y), NRF_LOG_FLOAT(z));
-//			NRF_LOG_INFO("E, 0x%hx, 0x%hx, 0x%hx, 0x%hx\n", accuracy, x, y, z);
-//
-//			ble_mde_update (&m_mde, &x, &y, &z);
-//
-//		}
-//		break;
-//	}
-
-	//DKW - Need to change from Euler to Quats - AND get linear accel
-
-	case PACKET_DATA_QUAT: {
-
-//		if (hal.new_gyro && hal.dmp_on) {
-//		            short gyro[3], accel_short[3], sensors;
-//		            unsigned char more;
-//		            long accel[3], quat[4], temperature;
-//
-//		}else {}
-
-  //DKW - This works but values are wrong and just rigged w/out sending Quat 'W"
-
-		    int16_t qw = inv_q16_to_float(data[0]);
-			int16_t qx = inv_q16_to_float(data[1]);
-			int16_t qy = inv_q16_to_float(data[2]);
-			int16_t qz = inv_q16_to_float(data[3]);
-
-			//if (ble_conn_state_encrypted(m_mde.conn_handle) ) {
-			if (ble_conn_state_status(m_mde.conn_handle) == BLE_CONN_STATUS_CONNECTED) {
-				NRF_LOG_INFO("Quat: [" NRF_LOG_FLOAT_MARKER " " NRF_LOG_FLOAT_MARKER " " NRF_LOG_FLOAT_MARKER "]\r\n", NRF_LOG_FLOAT(qx), NRF_LOG_FLOAT(qy), NRF_LOG_FLOAT(qz));
-				NRF_LOG_INFO("E, 0x%hx, 0x%hx, 0x%hx, 0x%hx, 0x%hx\n", accuracy, qw, qx, qy, qz);
-
-				ble_mde_update (&m_mde, &qx, &qy, &qz); //DKW - Add qw
-
+	case PACKET_DATA_LINEAR_ACCEL:
+		// Q16 g to mg, rounded and saturated to the int16 frame field.
+		for (i = 0; i < 3; i++) {
+			mg = ((int64_t)data[i] * 1000 + (data[i] < 0 ? -32768 : 32768)) / 65536;
+			m_mde.linear_accel[i] = (int16_t)MAX(MIN(mg, INT16_MAX), INT16_MIN);
+		}
+		break;
 
+	case PACKET_DATA_QUAT:
+		m_mde.samples++;
+		if (ble_conn_state_status(m_mde.conn_handle) != BLE_CONN_STATUS_CONNECTED) {
+			break;
+		}
+		// Q30 to Q14, w first.
+		for (i = 0; i < 4; i++) {
+			quat[i] = (int16_t)(data[i] >> 16);
 		}
+		if (m_mde.stream == MDE_STREAM_COMPRESSED) {
+			ble_mde_compressed_add(&m_mde, quat, (uint32_t)timestamp);
 			break;
 		}
-
-	//DKW - Added - Also need to add LINEAR Acceleration
-//	case PACKET_DATA_ACCEL: {
-//			int16_t ax = inv_q16_to_float(data[0]);
-//			int16_t ay = inv_q16_to_float(data[1]);
-//			int16_t az = inv_q16_to_float(data[2]);
-//
-//			//if (ble_conn_state_encrypted(m_mde.conn_handle) ) {
-//			if (ble_conn_state_status(m_mde.conn_handle) == BLE_CONN_STATUS_CONNECTED) {
-//				NRF_LOG_INFO("Accel: [" NRF_LOG_FLOAT_MARKER " " NRF_LOG_FLOAT_MARKER " " NRF_LOG_FLOAT_MARKER "]\r\n", NRF_LOG_FLOAT(x), NRF_LOG_FLOAT(y), NRF_LOG_FLOAT(z));
-//				NRF_LOG_INFO("E, 0x%hx, 0x%hx, 0x%hx, 0x%hx\n", accuracy, ax, ay, az);
-//
-//				ble_mde_update (&m_mde, &ax, &ay, &az);
-//
-//			}
-//			break;
-//		}
+		uint16_encode(m_mde.frame_seq++, &frame[MDE_FRAME_SEQ_OFFSET]);
+		uint32_encode((uint32_t)timestamp, &frame[MDE_FRAME_TIMESTAMP_OFFSET]);
+		for (i = 0; i < 4; i++) {
+			uint16_encode((uint16_t)quat[i], &frame[MDE_FRAME_QUAT_OFFSET + 2 * i]);
+		}
+		for (i = 0; i < 3; i++) {
+			uint16_encode((uint16_t)m_mde.linear_accel[i],
+					&frame[MDE_FRAME_ACCEL_OFFSET + 2 * i]);
+		}
+		ble_mde_frame_add(&m_mde, frame, (uint32_t)timestamp);
+		break;
 
 	default:
 		break;
@@ -1347,6 +1761,12 @@ static void twi_init(void) {
 			err_code);
 	APP_ERROR_CHECK(err_code);
 }
+/**@brief Function for sending what is batched before the sensors sleep.
+ */
+static void motiondriver_idle_callback(void) {
+	ble_mde_flush(&m_mde);
+}
+
 /**@brief Function to initialize and test the md612 drivers.
  */
 static void motiondriver_init(void) {
@@ -1355,6 +1775,16 @@ static void motiondriver_init(void) {
 	md612_configure(&platform_data);
 	md612_selftest();
 
+	/* The MDE service sends the quaternion and the linear acceleration in
+	 * one frame. The acceleration goes first, so it is ready when the
+	 * quaternion of the same fusion step sends the frame.
+	 */
+	md612_subscribe(PACKET_DATA_LINEAR_ACCEL, MD612_SINK_CALLBACK, 1);
+	md612_subscribe(PACKET_DATA_QUAT, MD612_SINK_CALLBACK, 1);
+#ifdef PYTHON_UART
+	md612_subscribe(PACKET_DATA_QUAT, MD612_SINK_PACKET, 1);
+#endif
+
 }
 /**@brief Function for application main entry.
  */
@@ -1365,17 +1795,21 @@ int main(void) {
 	// Initialize.
 	err_code = NRF_LOG_INIT(timestamp_func);
 	APP_ERROR_CHECK(err_code);
+	LATENCY_INIT();
+	PROFILE_INIT();
 
+	// Before any timer runs, timer events go through the scheduler. The
+	// md612 deadline tasks start in motiondriver_init.
+	scheduler_init();
 	timers_init();
 	buttons_leds_init(&erase_bonds);
 	twi_init();
 	nrf_delay_ms(10);
 
 	motiondriver_init();
+	notify_queue_init(MDE_TX_POLICY);
 	ble_stack_init();
 
-	scheduler_init();
-
 	peer_manager_init(erase_bonds);
 
 	if (erase_bonds == true) {
@@ -1390,6 +1824,7 @@ int main(void) {
 
 	// Start execution.
 	timers_start();
+	md612_set_batch_depth(MPU_FIFO_BATCH_DEPTH);
 
 	advertising_start();
 
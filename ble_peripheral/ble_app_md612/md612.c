@@ -1,4 +1,5 @@
-*   @defgroup  eMPL
+/**
+ *   @defgroup  eMPL
  *   @brief     Embedded Motion Processing Library
  *
  *   @{
@@ -15,6 +16,8 @@
 #include "nrf_log.h"
 #include "nrf_log_ctrl.h"
 #include "boards.h"
+#include "app_scheduler.h"
+#include "app_timer.h"
     
 #include "inv_mpu.h"
 #include "inv_mpu_dmp_motion_driver.h"
@@ -28,20 +31,11 @@
 
 #include "inv_pesky.h"
 #include "md612.h"
-
-#ifdef PYTHON_UART
-/* Data read from MPL. */
-#define PRINT_ACCEL     (0x01)
-#define PRINT_GYRO      (0x02)
-#define PRINT_QUAT      (0x04)
-#define PRINT_COMPASS   (0x08)
-#define PRINT_EULER     (0x10)
-#define PRINT_ROT_MAT   (0x20)
-#define PRINT_HEADING   (0x40)
-#define PRINT_PEDO      (0x80)
-#define PRINT_LINEAR_ACCEL (0x100)
-#define PRINT_GRAVITY_VECTOR (0x200)
-#endif
+#include "sample_clock.h"
+#include "sample_ring.h"
+#include "deadline.h"
+#include "latency.h"
+#include "profile.h"
 
 #define ACCEL_ON        (0x01)
 #define GYRO_ON         (0x02)
@@ -49,6 +43,12 @@
 
 /* Starting sampling rate. */
 #define DEFAULT_MPU_HZ  (200)
+/* With the DMP on, the MPU samples at 200 Hz and the DMP divides that down to
+ * the FIFO rate (DMP_SAMPLE_RATE in inv_mpu_dmp_motion_driver.c).
+ */
+#define DMP_HZ          (200)
+/* MAX_COMPASS_SAMPLE_RATE in inv_mpu.c. */
+#define MAX_COMPASS_HZ  (100)
 
 // #define FLASH_SIZE      (512)
 // #define FLASH_MEM_START ((void*)0x1800)
@@ -57,6 +57,31 @@
 #define TEMP_READ_MS    	(500)
 #define COMPASS_READ_MS 	(10)
 
+#ifdef COMPASS_ENABLED
+/* Read the compass along with the FIFO instead of polling it every
+ * COMPASS_READ_MS, see mpu_set_compass_fifo.
+ */
+#define COMPASS_IN_FIFO
+#endif
+
+/* Maximum number of DMP packets drained per dmp_read_fifo_batch call. */
+#define FIFO_BATCH_MAX  	(8)
+
+/* After this long without motion, as seen by the MPL, power down the gyro
+ * and the DMP and wait for a wake-on-motion interrupt from the accel running
+ * in low-power cycle mode. 0 to keep the full pipeline running.
+ */
+#ifndef MPU6050
+#define MOTION_SLEEP_MS     (10000)
+#else
+/* No wake-on-motion on the MPU6050. */
+#define MOTION_SLEEP_MS     (0)
+#endif
+#define MOTION_CHECK_MS     (1000)
+/* Wake-on-motion threshold in mg and accel wake-up rate in Hz while idle. */
+#define WOM_THRESH_MG       (100)
+#define WOM_LPA_HZ          (5)
+
 #define BLE_EULER_MS_SLOW   (200)		// if nothing has moved send the euler info every 15 seconds.
 #define BLE_EULER_MS_FAST	(0)		// if there is motion send it every .5 seconds.
 
@@ -69,6 +94,8 @@
 unsigned char *mpl_key = (unsigned char*)"eMPL 5.1";
 
 static platform_data_t const * m_platform_data;
+/* Data ready interrupts, from gyro_data_ready_cb to md612_aftersleep. */
+static sample_ring_t m_sample_ring;
 
 // struct rx_s {
 //     unsigned char header[3];
@@ -83,157 +110,187 @@ struct hal_s {
     volatile unsigned char new_gyro;
     volatile unsigned char new_temp;
     volatile unsigned char new_euler;
+    unsigned char new_data;
+    volatile unsigned char fifo_busy;
+    /* A read finished but the scheduler queue was full, md612_aftersleep
+     * runs the handler instead.
+     */
+    volatile unsigned char fifo_done;
+    unsigned char batch_depth;
+    unsigned char fifo_gap;
+    unsigned long last_overflows;
+    unsigned long fifo_dropped;
+    unsigned long last_sample_ms;
+    /* RTC time and edge count of the last data ready interrupt taken from
+     * the ring, and the edge count at the last drain.
+     */
+    uint64_t int_ticks;
+    unsigned short int_edges;
+    unsigned short drain_edges;
+    /* RTC time the drain timer fired, starts the latency trace in batching
+     * mode.
+     */
+    uint64_t drain_ticks;
+    unsigned char drain_edges_valid;
+    unsigned long missed_ints;
+    unsigned char fifo_draining;
 #ifdef COMPASS_ENABLED
     volatile unsigned char new_compass;
+    volatile unsigned char compass_busy;
+    volatile unsigned char compass_done;
+    int compass_result;
+    short compass_short[3];
 #endif
-    //unsigned char motion_int_mode;
+    /* Gyro and DMP off, waiting for the wake-on-motion interrupt. */
+    unsigned char motion_int_mode;
+    unsigned char motion_int_pending;
+    unsigned long still_ms;
     //unsigned long no_dmp_hz;
-    unsigned long next_pedo_ms;
-    unsigned long next_temp_ms;
-    unsigned long next_compass_ms;
-    unsigned long next_ble_ms_fast;
-    unsigned long next_ble_ms_slow;
+    unsigned long last_steps;
+    unsigned char rates_pending;
+    md612_rates_t rates;
     //unsigned int report;
     //unsigned short dmp_features;
     //struct rx_s rx;
 };
 static struct hal_s hal = {0};
 
-/* Get data from MPL.
- * TODO: Add return values to the inv_get_sensor_type_xxx APIs to differentiate
- * between new and stale data.
+APP_TIMER_DEF(m_fifo_drain_timer_id);
+
+/* MPL output subscriptions. Each fusion step, only the getters of active
+ * subscriptions run, and each only every divider steps.
  */
-static void read_from_mpl(void)
-{
+#define MAX_SUBSCRIPTIONS   (4)
+/* Standard gravity, as in the MPL's ACCEL_CONVERSION. */
+#define GRAVITY_MS2         (9.80665f)
+
+struct subscription_s {
+    unsigned char type;
+    unsigned char sink;
+    /* 0 if the slot is free. */
+    unsigned char divider;
+    unsigned char count;
+    /* Generation of the output last sent, see inv_get_eMPL_generation. */
+    unsigned long generation;
+};
+static struct subscription_s m_subscriptions[MAX_SUBSCRIPTIONS];
 
-	int8_t accuracy;
-	unsigned long timestamp;
+typedef int (*mpl_getter_t)(long *data, int8_t *accuracy,
+        inv_time_t *timestamp, unsigned long *generation);
 
-#ifdef PYTHON_UART
-	long msg;
-	long  data[9];
-	float float_data[3] = {0};
-#else
-	long data[4];
-#endif
+/* Linear acceleration in g, q16 like PACKET_DATA_ACCEL. The MPL gives it in
+ * m/s^2. Changes with the accel.
+ */
+static int get_linear_accel(long *data, int8_t *accuracy,
+        inv_time_t *timestamp, unsigned long *generation)
+{
+    float float_data[3];
 
-	// Make sure a call back function exists.
-	if (m_platform_data->cb == NULL) {
-        return;
+    if (*generation == inv_get_eMPL_generation(INV_OUTPUT_ACCEL)) {
+        return 0;
     }
+    *generation = inv_get_eMPL_generation(INV_OUTPUT_ACCEL);
+    inv_get_sensor_type_linear_acceleration(float_data, accuracy, timestamp);
+    data[0] = (long)(float_data[0] * (65536.f / GRAVITY_MS2));
+    data[1] = (long)(float_data[1] * (65536.f / GRAVITY_MS2));
+    data[2] = (long)(float_data[2] * (65536.f / GRAVITY_MS2));
+    return 1;
+}
 
+static const mpl_getter_t m_getters[NUM_DATA_PACKETS] = {
+    [PACKET_DATA_ACCEL]         = inv_get_sensor_type_accel_if_newer,
+    [PACKET_DATA_GYRO]          = inv_get_sensor_type_gyro_if_newer,
+    [PACKET_DATA_COMPASS]       = inv_get_sensor_type_compass_if_newer,
+    [PACKET_DATA_QUAT]          = inv_get_sensor_type_quat_if_newer,
+    [PACKET_DATA_EULER]         = inv_get_sensor_type_euler_if_newer,
+    [PACKET_DATA_ROT]           = inv_get_sensor_type_rot_mat_if_newer,
+    [PACKET_DATA_HEADING]       = inv_get_sensor_type_heading_if_newer,
+    [PACKET_DATA_LINEAR_ACCEL]  = get_linear_accel,
+};
 
-   	// read the euler values and send to call back function.
-//    if (inv_get_sensor_type_euler(data, &accuracy, (inv_time_t*)&timestamp)) {
-//    	m_platform_data->cb(PACKET_DATA_EULER,  data, accuracy, timestamp);
-//    }
-
-
-
-//DKW Changed to get Quats
-//	if (inv_get_sensor_type_quat(data, &accuracy, (inv_time_t*) &timestamp)) {
-//		m_platform_data->cb(PACKET_DATA_QUAT, data, accuracy, timestamp,
-//				hal.tap);
-//		hal.tap = 0;
-//	}
-
-
-//DKW Added Accel
-
-	if (inv_get_sensor_type_accel(data, &accuracy, (inv_time_t*) &timestamp)) {
-			m_platform_data->cb(PACKET_DATA_ACCEL, data, accuracy, timestamp);
-
-		}
-
-
-    //NRF_LOG_INFO("[%d] Accuracy: %d\r\n", timestamp, accuracy);
+/* md612_subscribe on the given table, so a set of subscriptions can be tried
+ * on a copy first.
+ */
+static int subscribe(struct subscription_s *subs, unsigned char type,
+        unsigned char sink, unsigned char divider)
+{
+    struct subscription_s *free_slot = NULL;
+    unsigned char ii;
 
-     if (inv_get_sensor_type_quat(data, &accuracy, (inv_time_t*)&timestamp)) {
-        /* Sends a quaternion packet to the PC. Since this is used by the Python
-         * test app to visually represent a 3D quaternion, it's sent each time
-         * the MPL has new data.
-         */
-         eMPL_send_quat(data);
+    if ((type >= NUM_DATA_PACKETS) || (sink > MD612_SINK_PACKET)) {
+        return -1;
+    }
+    for (ii = 0; ii < MAX_SUBSCRIPTIONS; ii++) {
+        struct subscription_s *sub = &subs[ii];
+        if (sub->divider && (sub->type == type) && (sub->sink == sink)) {
+            sub->divider = divider;
+            sub->count = 0;
+            return 0;
+        }
+        if (!sub->divider && !free_slot) {
+            free_slot = sub;
+        }
+    }
+    if (!divider) {
+        return 0;
+    }
+    if (!free_slot) {
+        return -1;
+    }
+    free_slot->type = type;
+    free_slot->sink = sink;
+    free_slot->divider = divider;
+    free_slot->count = 0;
+    free_slot->generation = 0;
+    return 0;
+}
 
-         // /* Specific data packets can be sent or suppressed using USB commands. */
-         // if (hal.report & PRINT_QUAT)
-         //     eMPL_send_data(PACKET_DATA_QUAT, data);
-     }
+int md612_subscribe(unsigned char type, unsigned char sink,
+        unsigned char divider)
+{
+    return subscribe(m_subscriptions, type, sink, divider);
+}
 
-//     if (hal.report & PRINT_ACCEL) {
-//         if (inv_get_sensor_type_accel(data, &accuracy,
-//             (inv_time_t*)&timestamp))
-//             eMPL_send_data(PACKET_DATA_ACCEL, data);
-//     }
-//     if (hal.report & PRINT_GYRO) {
-//         if (inv_get_sensor_type_gyro(data, &accuracy,
-//             (inv_time_t*)&timestamp))
-//             eMPL_send_data(PACKET_DATA_GYRO, data);
-//     }
-// #ifdef COMPASS_ENABLED
-//     if (hal.report & PRINT_COMPASS) {
-//         if (inv_get_sensor_type_compass(data, &accuracy,
-//             (inv_time_t*)&timestamp))
-//             eMPL_send_data(PACKET_DATA_COMPASS, data);
-//     }
-// #endif
-//     if (hal.report & PRINT_EULER) {
-//         if (inv_get_sensor_type_euler(data, &accuracy,
-//             (inv_time_t*)&timestamp))
-//             eMPL_send_data(PACKET_DATA_EULER, data);
-//     }
-//     if (hal.report & PRINT_ROT_MAT) {
-//         if (inv_get_sensor_type_rot_mat(data, &accuracy,
-//             (inv_time_t*)&timestamp))
-//             eMPL_send_data(PACKET_DATA_ROT, data);
-//     }
-//     if (hal.report & PRINT_HEADING) {
-//         if (inv_get_sensor_type_heading(data, &accuracy,
-//             (inv_time_t*)&timestamp))
-//             eMPL_send_data(PACKET_DATA_HEADING, data);
-//     }
-//     if (hal.report & PRINT_LINEAR_ACCEL) {
-//         if (inv_get_sensor_type_linear_acceleration(float_data, &accuracy, (inv_time_t*)&timestamp)) {
-//         	MPL_LOGI("Linear Accel: "NRF_LOG_FLOAT_MARKER" "NRF_LOG_FLOAT_MARKER" "NRF_LOG_FLOAT_MARKER"\r\n",
-//         			NRF_LOG_FLOAT(float_data[0]),
-//                     NRF_LOG_FLOAT(float_data[1]),
-//                     NRF_LOG_FLOAT(float_data[2]));                                        
-//          }
-//     }
-//     if (hal.report & PRINT_GRAVITY_VECTOR) {
-//             if (inv_get_sensor_type_gravity(float_data, &accuracy,
-//                 (inv_time_t*)&timestamp))
-//             	MPL_LOGI("Gravity Vector: "NRF_LOG_FLOAT_MARKER" "NRF_LOG_FLOAT_MARKER" "NRF_LOG_FLOAT_MARKER"\r\n",
-//             			NRF_LOG_FLOAT(float_data[0]),
-//                         NRF_LOG_FLOAT(float_data[1]),
-//                         NRF_LOG_FLOAT(float_data[2]));
-//     }
-//     if (hal.report & PRINT_PEDO) {
-//         unsigned long timestamp;
-//         get_ms(&timestamp);
-//         if (timestamp > hal.next_pedo_ms) {
-//             hal.next_pedo_ms = timestamp + PEDO_READ_MS;
-//             unsigned long step_count, walk_time;
-//             dmp_get_pedometer_step_count(&step_count);
-//             dmp_get_pedometer_walk_time(&walk_time);
-//             MPL_LOGI("Walked %ld steps over %ld milliseconds..\n", step_count,
-//             walk_time);
-//         }
-//     }
+/* Get data from MPL and hand it to the subscribers. Outputs the MPL has not
+ * updated since a subscriber last got them are neither computed nor sent.
+ */
+static void read_from_mpl(void)
+{
+    struct subscription_s *sub;
+    long data[9];
+    int8_t accuracy;
+    inv_time_t timestamp;
+    unsigned char ii;
+
+    for (ii = 0; ii < MAX_SUBSCRIPTIONS; ii++) {
+        sub = &m_subscriptions[ii];
+        if (!sub->divider || (++sub->count < sub->divider)) {
+            continue;
+        }
+        sub->count = 0;
+        if (!m_getters[sub->type](data, &accuracy, &timestamp,
+                &sub->generation)) {
+            continue;
+        }
 
-    // /* Whenever the MPL detects a change in motion state, the application can
-    //  * be notified. For this example, we use an LED to represent the current
-    //  * motion state.
-    //  */
-    // msg = inv_get_message_level_0(INV_MSG_MOTION_EVENT |
-    //         INV_MSG_NO_MOTION_EVENT);
-    // if (msg) {
-    //     if (msg & INV_MSG_MOTION_EVENT) {
-    //         MPL_LOGI("Motion!\n");
-    //     } else if (msg & INV_MSG_NO_MOTION_EVENT) {
-    //         MPL_LOGI("No motion!\n");
-    //     }
-    // }
+        switch (sub->sink) {
+        case MD612_SINK_CALLBACK:
+            if (m_platform_data->cb) {
+                m_platform_data->cb(sub->type, data, accuracy, timestamp);
+            }
+            break;
+        case MD612_SINK_PACKET:
+            /* The Python test app draws the quaternion packet. */
+            if (sub->type == PACKET_DATA_QUAT) {
+                eMPL_send_quat(data);
+            } else {
+                eMPL_send_data(sub->type, data);
+            }
+            break;
+        default:
+            break;
+        }
+    }
 }
 
 #ifdef COMPASS_ENABLED
@@ -708,13 +765,92 @@ static inline void run_self_test(void)
 // }
 
 /* Every time new gyro data is available, this function is called in an
- * ISR context. In this example, it sets a flag protecting the FIFO read
- * function.
+ * ISR context. It queues the interrupt time for md612_aftersleep, so no
+ * edge is lost if several come before the main loop runs.
  */
 static void gyro_data_ready_cb(nrf_drv_gpiote_pin_t pin, nrf_gpiote_polarity_t action)
 {
+    sample_ring_push(&m_sample_ring, timestamp_ticks());
+}
+/* In batching mode the DMP only interrupts on gestures and the FIFO is
+ * drained when this timer fires, once per batch.
+ */
+static void fifo_drain_timeout_handler(void * p_context)
+{
+    hal.drain_ticks = timestamp_ticks();
     hal.new_gyro = 1;
 }
+
+#if defined COMPASS_ENABLED && !defined COMPASS_IN_FIFO
+/* We're not using a data ready interrupt for the compass, so we'll make our
+ * compass reads timer-based instead.
+ */
+static void compass_task(void)
+{
+    if ((hal.sensors & COMPASS_ON) && !hal.motion_int_mode) {
+        hal.new_compass = 1;
+    }
+}
+#endif
+
+/* Temperature data doesn't need to be read with every gyro sample. DMP off
+ * only.
+ */
+static void temp_task(void)
+{
+    hal.new_temp = 1;
+}
+
+static void pedo_task(void)
+{
+    unsigned long step_count, walk_time;
+
+    if (!hal.dmp_on || hal.motion_int_mode ||
+        dmp_get_pedometer_step_count(&step_count) ||
+        (step_count == hal.last_steps)) {
+        return;
+    }
+    hal.last_steps = step_count;
+    dmp_get_pedometer_walk_time(&walk_time);
+    MPL_LOGI("Walked %ld steps over %ld milliseconds..\n", step_count,
+        walk_time);
+}
+
+/* Publish every BLE_EULER_MS_FAST while there is motion, and every
+ * BLE_EULER_MS_SLOW otherwise.
+ */
+static void ble_fast_task(void)
+{
+    if (hal.new_euler != 2) {
+        hal.new_euler = 1;
+    }
+}
+
+static void ble_slow_task(void)
+{
+    hal.new_euler = 2;
+}
+
+/* Count how long the MPL has reported no motion. The switch to the wake on
+ * motion mode is left to md612_aftersleep, as it can't happen while a FIFO
+ * or compass read is in flight.
+ */
+static void motion_task(void)
+{
+    unsigned int counter;
+
+    if (hal.motion_int_mode) {
+        return;
+    }
+    if (inv_get_motion_state(&counter) != INV_NO_MOTION) {
+        hal.still_ms = 0;
+        return;
+    }
+    hal.still_ms += MOTION_CHECK_MS;
+    if (hal.still_ms >= MOTION_SLEEP_MS) {
+        hal.motion_int_pending = 1;
+    }
+}
 /*******************************************************************************/
 
 void md612_configure(platform_data_t const * p_platform_data)
@@ -828,6 +964,10 @@ void md612_configure(platform_data_t const * p_platform_data)
 #endif
     /* Push both gyro and accel data into the FIFO. */
     mpu_configure_fifo(INV_XYZ_GYRO | INV_XYZ_ACCEL);
+#ifdef COMPASS_IN_FIFO
+    /* And the compass, so its samples line up with the gyro and accel. */
+    mpu_set_compass_fifo(1);
+#endif
     mpu_set_sample_rate(DEFAULT_MPU_HZ);
 #ifdef COMPASS_ENABLED
     /* The compass sampling rate can be less than the gyro/accel sampling rate.
@@ -877,11 +1017,7 @@ void md612_configure(platform_data_t const * p_platform_data)
     hal.dmp_on = 0;
     //hal.report = 0;
     //hal.rx.cmd = 0;
-    hal.next_pedo_ms = 0;
-    hal.next_compass_ms = 0;
-    hal.next_temp_ms = 0;
-    hal.next_ble_ms_fast = 0;
-    hal.next_ble_ms_slow = 0;
+    hal.last_steps = 0;
 
     // /* Compass reads are handled by scheduler. */
     // get_ms(&timestamp);
@@ -955,6 +1091,29 @@ void md612_configure(platform_data_t const * p_platform_data)
     inv_set_quat_sample_rate(1000000L / DEFAULT_MPU_HZ);
     mpu_set_dmp_state(1);
     hal.dmp_on = 1;
+    hal.batch_depth = 1;
+    sample_clock_init(DEFAULT_MPU_HZ);
+
+    APP_ERROR_CHECK(app_timer_create(&m_fifo_drain_timer_id,
+        APP_TIMER_MODE_REPEATED, fifo_drain_timeout_handler));
+
+#if defined COMPASS_ENABLED && !defined COMPASS_IN_FIFO
+    APP_ERROR_CHECK(deadline_add(compass_task, COMPASS_READ_MS));
+#endif
+    /* With the DMP on, the temperature comes with every FIFO read, see
+     * fifo_batch_handler.
+     */
+    if (!hal.dmp_on) {
+        APP_ERROR_CHECK(deadline_add(temp_task, TEMP_READ_MS));
+    }
+    APP_ERROR_CHECK(deadline_add(pedo_task, PEDO_READ_MS));
+    if (BLE_EULER_MS_FAST) {
+        APP_ERROR_CHECK(deadline_add(ble_fast_task, BLE_EULER_MS_FAST));
+        APP_ERROR_CHECK(deadline_add(ble_slow_task, BLE_EULER_MS_SLOW));
+    }
+    if (MOTION_SLEEP_MS) {
+        APP_ERROR_CHECK(deadline_add(motion_task, MOTION_CHECK_MS));
+    }
 
     long bias[3];
     bias[0] = 6211584;
@@ -984,6 +1143,183 @@ void md612_configure(platform_data_t const * p_platform_data)
 //     dmp_set_shake_reject_timeout(10);
 }
 
+void md612_set_batch_depth(unsigned char depth)
+{
+    unsigned short fifo_size, fifo_rate;
+    unsigned char packet_length;
+    unsigned short max_depth;
+#ifdef COMPASS_IN_FIFO
+    unsigned long compass_ms;
+#endif
+
+    if (!hal.dmp_on) {
+        return;
+    }
+    if (hal.motion_int_mode) {
+        /* Applied on wake up, see exit_motion_int_mode. */
+        hal.batch_depth = depth;
+        return;
+    }
+
+    mpu_get_fifo_size(&fifo_size);
+    dmp_get_packet_length(&packet_length);
+    dmp_get_fifo_rate(&fifo_rate);
+
+    /* Leave half of the FIFO free so a drain held up by BLE events doesn't
+     * overflow it.
+     */
+    max_depth = (fifo_size / packet_length) / 2;
+    if (depth > max_depth) {
+        depth = max_depth;
+    }
+    if (!depth) {
+        depth = 1;
+    }
+    hal.batch_depth = depth;
+    /* In batching mode the interrupts are gestures, not packets. */
+    hal.drain_edges_valid = 0;
+
+#ifdef COMPASS_IN_FIFO
+    /* With the DMP on, the compass is read once per FIFO drain. */
+    compass_ms = (depth * 1000UL) / fifo_rate;
+    if (compass_ms < COMPASS_READ_MS) {
+        compass_ms = COMPASS_READ_MS;
+    }
+    inv_set_compass_sample_rate(compass_ms * 1000L);
+#endif
+
+    APP_ERROR_CHECK(app_timer_stop(m_fifo_drain_timer_id));
+    if (depth == 1) {
+        /* Wake up on every sample. */
+        dmp_set_interrupt_mode(DMP_INT_CONTINUOUS);
+    } else {
+        dmp_set_interrupt_mode(DMP_INT_GESTURE);
+        APP_ERROR_CHECK(app_timer_start(m_fifo_drain_timer_id,
+            APP_TIMER_TICKS((depth * 1000UL) / fifo_rate, APP_TIMER_PRESCALER),
+            NULL));
+    }
+    MPL_LOGI("FIFO batch depth %d.\n", depth);
+}
+
+int md612_set_rates(md612_rates_t const *rates)
+{
+    struct subscription_s subs[MAX_SUBSCRIPTIONS];
+    unsigned short sample_rate;
+    unsigned char ii;
+
+    if (rates->sample_hz && (hal.dmp_on ||
+        (rates->sample_hz < 4) || (rates->sample_hz > 1000))) {
+        return -1;
+    }
+    /* The DMP can only run at an integer divider of its rate, anything else
+     * would run faster than asked.
+     */
+    if (rates->fifo_hz && (!hal.dmp_on || (rates->fifo_hz > DMP_HZ) ||
+        (DMP_HZ % rates->fifo_hz))) {
+        return -1;
+    }
+    if (rates->compass_hz) {
+#ifdef COMPASS_ENABLED
+        /* The compass is read at a divider of the MPU rate.
+         * mpu_get_sample_rate fails while the DMP is on.
+         */
+        if (hal.dmp_on) {
+            sample_rate = DMP_HZ;
+        } else if (rates->sample_hz) {
+            sample_rate = rates->sample_hz;
+        } else if (mpu_get_sample_rate(&sample_rate)) {
+            return -1;
+        }
+        if ((rates->compass_hz > sample_rate) ||
+            (rates->compass_hz > MAX_COMPASS_HZ)) {
+            return -1;
+        }
+#else
+        return -1;
+#endif
+    }
+    if (rates->publish_count > MD612_MAX_PUBLISH) {
+        return -1;
+    }
+    /* Only the types the callback handles, and only as many new ones as
+     * there are free slots, tried in order on a copy of the table.
+     */
+    memcpy(subs, m_subscriptions, sizeof(subs));
+    for (ii = 0; ii < rates->publish_count; ii++) {
+        if ((rates->publish[ii].type >= NUM_DATA_PACKETS) ||
+            !(m_platform_data->cb_types & (1U << rates->publish[ii].type)) ||
+            subscribe(subs, rates->publish[ii].type, MD612_SINK_CALLBACK,
+                rates->publish[ii].divider)) {
+            return -1;
+        }
+    }
+    hal.rates = *rates;
+    hal.rates_pending = 1;
+    return 0;
+}
+
+/* Called with no FIFO or compass read in flight. */
+static void apply_rates(void)
+{
+    md612_rates_t const *rates = &hal.rates;
+    unsigned short rate;
+    unsigned char ii;
+#ifdef COMPASS_ENABLED
+    unsigned short compass_rate;
+#endif
+
+    hal.rates_pending = 0;
+    if (rates->sample_hz) {
+        mpu_set_sample_rate(rates->sample_hz);
+    }
+    if (rates->fifo_hz) {
+        dmp_set_fifo_rate(rates->fifo_hz);
+    }
+#ifdef COMPASS_ENABLED
+    if (rates->compass_hz) {
+        mpu_set_compass_sample_rate(rates->compass_hz);
+    }
+#endif
+    if (rates->sample_hz || rates->fifo_hz || rates->compass_hz) {
+        /* The packets in the FIFO were taken at the old rate. */
+        mpu_reset_fifo();
+        hal.fifo_gap = 1;
+
+        /* Sync driver configuration with MPL. */
+        if (hal.dmp_on) {
+            dmp_get_fifo_rate(&rate);
+            inv_set_quat_sample_rate(1000000L / rate);
+        } else {
+            mpu_get_sample_rate(&rate);
+        }
+        inv_set_gyro_sample_rate(1000000L / rate);
+        inv_set_accel_sample_rate(1000000L / rate);
+        sample_clock_init(rate);
+#ifdef COMPASS_ENABLED
+        mpu_get_compass_sample_rate(&compass_rate);
+        inv_set_compass_sample_rate(1000000L / compass_rate);
+#ifndef COMPASS_IN_FIFO
+        deadline_set_period(compass_task, 1000 / compass_rate);
+#endif
+#endif
+        if (hal.dmp_on) {
+            /* Recompute the drain period, and with the compass in the FIFO
+             * its rate as seen by the MPL.
+             */
+            md612_set_batch_depth(hal.batch_depth);
+        }
+        MPL_LOGI("Sample rate %d Hz.\n", rate);
+    }
+    for (ii = 0; ii < rates->publish_count; ii++) {
+        if (md612_subscribe(rates->publish[ii].type, MD612_SINK_CALLBACK,
+                rates->publish[ii].divider)) {
+            /* md612_set_rates checked there was room. */
+            MPL_LOGE("No subscription slot for type %d.\n",
+                rates->publish[ii].type);
+        }
+    }
+}
+
 void md612_selftest()
 {
     run_self_test();
@@ -994,9 +1330,7 @@ void md612_selftest()
 }
 
 void md612_beforesleep()
-{       
-    unsigned long timestamp;
-
+{
     // uint8_t c;
     // if (app_uart_get(&c) == NRF_SUCCESS) {
     //     /* A byte has been received via USART. See handle_input for a list of
@@ -1004,132 +1338,442 @@ void md612_beforesleep()
     //      */
     //     handle_input(c);
     // }
-    get_ms(&timestamp);//MPL_LOGI("Timestamp: %d\n", timestamp);
-
-#ifdef COMPASS_ENABLED
-    /* We're not using a data ready interrupt for the compass, so we'll
-        * make our compass reads timer-based instead.
+    /* The compass, temperature (DMP off), pedometer and BLE publish tasks
+        * run from the deadline timer, see md612_configure. The motion interrupt mode
+        * is entered and left in md612_aftersleep, the main loop sleeps
+        * while waiting for the interrupt.
         */
-    if ((timestamp > hal.next_compass_ms) /*&& !hal.lp_accel_mode*/ &&
-        hal.new_gyro && (hal.sensors & COMPASS_ON)) {
-        hal.next_compass_ms = timestamp + COMPASS_READ_MS;
-        hal.new_compass = 1;
+}
+
+/* Take the data ready events queued by the ISR up to count_ticks, in order,
+ * and return how many. The newest one anchors the next FIFO drain. Later
+ * ones are for packets written after the FIFO count was read, they stay
+ * queued for the next read.
+ */
+static unsigned char take_sample_events(uint64_t count_ticks)
+{
+    sample_event_t event;
+    unsigned char taken = 0;
+
+    while (sample_ring_peek(&m_sample_ring, &event) &&
+        (event.ticks <= count_ticks)) {
+        sample_ring_pop(&m_sample_ring, &event);
+        hal.int_ticks = event.ticks;
+        hal.int_edges = event.edges;
+        taken++;
+    }
+    return taken;
+}
+
+/* Time the newest packet counted at count_ticks was written. When the MPU
+ * interrupts on every packet that's the time of the last interrupt before
+ * the count. In batching mode there is no interrupt, the packet was written
+ * some time in the period before the count.
+ */
+static uint64_t fifo_anchor_us(uint64_t count_ticks)
+{
+    if (hal.batch_depth > 1) {
+        return TIMESTAMP_TICKS_TO_US(count_ticks) - sample_clock_period_us() / 2;
+    }
+    take_sample_events(count_ticks);
+    return TIMESTAMP_TICKS_TO_US(hal.int_ticks);
+}
+
+/* Packets of this drain written without a data ready interrupt to anchor
+ * them, missed by the GPIOTE or dropped on a full ring: the FIFO count less
+ * the interrupts since the last drain. Only meaningful when the MPU
+ * interrupts on every packet and the FIFO follows on from the last drain.
+ */
+static unsigned short missed_interrupts(unsigned short packets)
+{
+    unsigned short interrupts = hal.int_edges - hal.drain_edges;
+    unsigned char valid = hal.drain_edges_valid;
+
+    hal.drain_edges = hal.int_edges;
+    hal.drain_edges_valid = 1;
+    if (!valid || hal.fifo_gap || (hal.batch_depth > 1) ||
+        (packets <= interrupts)) {
+        return 0;
+    }
+    hal.missed_ints += packets - interrupts;
+    return packets - interrupts;
+}
+
+/* Packets were lost in a FIFO overflow or reset. Estimate how many from the
+ * time since the last sample and tell the MPL the data is not contiguous, so
+ * it doesn't integrate across the gap. Called with the first sample after the
+ * gap, once the samples before it have been processed.
+ */
+static void handle_fifo_gap(unsigned long sensor_timestamp)
+{
+    unsigned short rate = 0;
+    unsigned long lost = 0;
+
+    hal.fifo_gap = 0;
+    if (hal.dmp_on) {
+        dmp_get_fifo_rate(&rate);
+    } else {
+        mpu_get_sample_rate(&rate);
+    }
+    if (rate && hal.last_sample_ms &&
+        (sensor_timestamp > hal.last_sample_ms)) {
+        lost = ((sensor_timestamp - hal.last_sample_ms) * rate + 500) / 1000;
+        lost = lost ? (lost - 1) : 0;
+        hal.fifo_dropped += lost;
+    }
+
+    inv_gyro_was_turned_off();
+    inv_accel_was_turned_off();
+    inv_quaternion_sensor_was_turned_off();
+    MPL_LOGI("FIFO gap, %lu packets lost (%lu total).\n", lost,
+        hal.fifo_dropped);
+}
+
+/* Push one DMP sample to the MPL. The MPL only keeps the latest sample of
+ * each sensor, so the fusion for the previous sample is run first.
+ */
+static void build_dmp_sample(short *gyro, short *accel_short, long *quat,
+        short sensors, unsigned long sensor_timestamp)
+{
+    long accel[3];
+
+    if (hal.new_data) {
+        inv_execute_on_data();
+        hal.new_data = 0;
+    }
+    if (hal.fifo_gap) {
+        handle_fifo_gap(sensor_timestamp);
+    }
+    hal.last_sample_ms = sensor_timestamp;
+    if (sensors & INV_XYZ_GYRO) {
+        /* Push the new data to the MPL. */
+        inv_build_gyro(gyro, sensor_timestamp);
+        hal.new_data = 1;
+    }
+    if (sensors & INV_XYZ_ACCEL) {
+        accel[0] = (long)accel_short[0];
+        accel[1] = (long)accel_short[1];
+        accel[2] = (long)accel_short[2];
+        inv_build_accel(accel, 0, sensor_timestamp);
+        hal.new_data = 1;
+    }
+    if (sensors & INV_WXYZ_QUAT) {
+        inv_build_quat(quat, 0, sensor_timestamp);
+        hal.new_data = 1;
+    }
+}
+
+#ifdef COMPASS_IN_FIFO
+/* Push the compass sample read along with the FIFO, stamped with the FIFO
+ * sample it came with.
+ */
+static void build_fifo_compass(unsigned long sensor_timestamp)
+{
+    short compass_short[3];
+    long compass[3];
+
+    if (mpu_get_compass_fifo(compass_short)) {
+        return;
     }
+    compass[0] = (long)compass_short[0];
+    compass[1] = (long)compass_short[1];
+    compass[2] = (long)compass_short[2];
+    inv_build_compass(compass, 0, sensor_timestamp);
+    hal.new_data = 1;
+}
 #endif
-    /* Temperature data doesn't need to be read with every gyro sample.
-        * Let's make them timer-based like the compass reads.
+
+/* Run the fusion on the pending data and publish the outputs. */
+static void execute_on_new_data(void)
+{
+    if (!hal.new_data) {
+        return;
+    }
+    hal.new_data = 0;
+
+    if(inv_execute_on_data()) {
+        MPL_LOGE("ERROR execute on data\n");
+    }
+    LATENCY_MARK(LATENCY_FUSION);
+
+    /* This function reads bias-compensated sensor data and sensor
+        * fusion outputs from the MPL. The outputs are formatted as seen
+        * in eMPL_outputs.c. This function only needs to be called at the
+        * rate requested by the host.
         */
-    if (timestamp > hal.next_temp_ms) {
-        hal.next_temp_ms = timestamp + TEMP_READ_MS;
-        hal.new_temp = 1;
+
+    //DKW - Try Changing to Accel Data
+    if (!BLE_EULER_MS_FAST) {
+    	/* No publish period, send every result. */
+    	read_from_mpl();
+    } else if (hal.new_euler) {
+    	if (hal.motion) {
+    		read_from_mpl();
+    		hal.motion = 0;
+    	}
+    	// if there is not motion only send if the slow timme out has occured.
+    	else if (hal.new_euler == 2) {
+    		read_from_mpl();
+    	}
+    	hal.new_euler = 0;
     }
+}
 
-    /* setup two timers one for sending euler slow (15sec) and fast when there is motion (.5sec)
-     *
+/* Runs from the main loop once dmp_read_fifo_async has the packets in RAM. */
+static void fifo_batch_handler(void * p_event_data, uint16_t event_size)
+{
+    short gyro[FIFO_BATCH_MAX][3], accel_short[FIFO_BATCH_MAX][3], sensors;
+    unsigned char count, more, ii, first = 1;
+    unsigned short missed;
+    int result;
+    long quat[FIFO_BATCH_MAX][4], temperature;
+    unsigned long sample_timestamp[FIFO_BATCH_MAX];
+    uint64_t count_ticks, anchor_us;
+
+    hal.fifo_busy = 0;
+    hal.fifo_done = 0;
+    LATENCY_MARK(LATENCY_FIFO_READ);
+    /* Only the packets written before the FIFO count was read are in this
+     * batch, anchor it to the newest of them.
      */
-    if (timestamp > hal.next_ble_ms_fast) {
-    	hal.next_ble_ms_fast = timestamp + BLE_EULER_MS_FAST;
-    	hal.new_euler = 1;
-    	hal.motion = 1;
-    }
-
-    if (timestamp > hal.next_ble_ms_slow) {
-    	hal.next_ble_ms_slow = timestamp + BLE_EULER_MS_SLOW;
-    	hal.new_euler = 2;
-    }
-    // if (hal.motion_int_mode) {
-    //     /* Enable motion interrupt. */
-    //     mpu_lp_motion_interrupt(500, 1, 5);
-    //     /* Notify the MPL that contiguity was broken. */
-    //     inv_accel_was_turned_off();
-    //     inv_gyro_was_turned_off();
-    //     inv_compass_was_turned_off();
-    //     inv_quaternion_sensor_was_turned_off();
-    //     /* Wait for the MPU interrupt. */
-    //     while (!hal.new_gyro)
-    //     {
-    //         // Make sure any pending events are cleared
-    //         __SEV();
-    //         __WFE();
-    //         // Enter System ON sleep mode
-    //         __WFE();
-    //     }
-
-    //     /* Restore the previous sensor configuration. */
-    //     mpu_lp_motion_interrupt(0, 0, 0);
-    //     hal.motion_int_mode = 0;
-    // }
+    if (mpu_get_fifo_count_ticks(&count_ticks)) {
+        count_ticks = timestamp_ticks();
+    }
+    anchor_us = fifo_anchor_us(count_ticks);
+
+    /* The FIFO can contain any combination of gyro, accel, quaternion, and
+        * gesture data. The sensors parameter tells the caller which data
+        * fields were actually populated with new data. For example, if
+        * sensors == (INV_XYZ_GYRO | INV_WXYZ_QUAT), then the FIFO isn't
+        * being filled with accel data.
+        * The driver parses the gesture data to determine if a gesture
+        * event has occurred; on an event, the application will be notified
+        * via a callback (assuming that a callback function was properly
+        * registered). The more parameter is non-zero if the backlog did not
+        * fit in the read buffer.
+        * A result of -2 means the FIFO overflowed before these samples, -1
+        * that it was reset after them.
+        */
+    do {
+        PROFILE_START(start);
+        result = dmp_get_fifo_batch(gyro, accel_short, quat,
+            sample_timestamp, &sensors, FIFO_BATCH_MAX, &count, &more);
+        PROFILE_STOP(start, dmp_get_fifo_batch, "dmp_get_fifo_batch");
+        if (result == -2) {
+            hal.fifo_gap = 1;
+        }
+        if (first) {
+            /* The driver stamps the samples with the decode time. Anchor
+                * the whole backlog to the time the newest packet was written
+                * instead and back-fill with the measured sample period.
+                */
+            first = 0;
+            if (hal.fifo_gap) {
+                sample_clock_resync();
+            }
+            /* The newest packets came after the anchor interrupt. */
+            missed = missed_interrupts(count + more);
+            sample_clock_anchor(anchor_us + missed * sample_clock_period_us(),
+                count + more);
+        }
+        for (ii = 0; ii < count; ii++) {
+            sample_timestamp[ii] = (unsigned long)(sample_clock_next() / 1000);
+            build_dmp_sample(gyro[ii], accel_short[ii], quat[ii], sensors,
+                sample_timestamp[ii]);
+        }
+        if (result == -1) {
+            hal.fifo_gap = 1;
+        }
+    } while (count);
+    /* TEMP_OUT is read along with the FIFO count, so the gyro temperature
+        * compensation gets a new value with every batch.
+        */
+    if (!mpu_get_temperature_fifo(&temperature)) {
+        inv_build_temp(temperature, hal.last_sample_ms);
+    }
+#ifdef COMPASS_IN_FIFO
+    /* Read in the same transaction as the FIFO count, so it goes with the
+        * newest sample.
+        */
+    build_fifo_compass(hal.last_sample_ms);
+#endif
+
+    if (more) {
+        hal.new_gyro = 1;
+    }
+    LATENCY_MARK(LATENCY_BUILD);
+    execute_on_new_data();
 }
 
-void md612_aftersleep()
+/* TWI interrupt context. Hand the packets over to the main loop. */
+static void fifo_read_done(int result)
 {
-    int new_data = 0;
+    if (app_sched_event_put(NULL, 0, fifo_batch_handler) != NRF_SUCCESS) {
+        hal.fifo_done = 1;
+    }
+}
+
+#ifdef COMPASS_ENABLED
+static void compass_handler(void * p_event_data, uint16_t event_size)
+{
+    long compass[3];
     unsigned long sensor_timestamp;
 
-//    if (hal.new_gyro) {
-//    	NRF_LOG_INFO ("after sleep ngryro=%d, dmpon=%d\r\n", hal.new_gyro, hal.dmp_on);
-//    }
-
-
-    // if (hal.new_gyro && hal.lp_accel_mode) {
-    //     short accel_short[3];
-    //     long accel[3];
-    //     mpu_get_accel_reg(accel_short, &sensor_timestamp);
-    //     accel[0] = (long)accel_short[0];
-    //     accel[1] = (long)accel_short[1];
-    //     accel[2] = (long)accel_short[2];
-    //     inv_build_accel(accel, 0, sensor_timestamp);
-    //     new_data = 1;
-    //     hal.new_gyro = 0;
-    // } else
-    if (hal.new_gyro && hal.dmp_on) {
-        short gyro[3], accel_short[3], sensors;
-        unsigned char more;
-        long accel[3], quat[4], temperature;
-        /* This function gets new data from the FIFO when the DMP is in
-            * use. The FIFO can contain any combination of gyro, accel,
-            * quaternion, and gesture data. The sensors parameter tells the
-            * caller which data fields were actually populated with new data.
-            * For example, if sensors == (INV_XYZ_GYRO | INV_WXYZ_QUAT), then
-            * the FIFO isn't being filled with accel data.
-            * The driver parses the gesture data to determine if a gesture
-            * event has occurred; on an event, the application will be notified
-            * via a callback (assuming that a callback function was properly
-            * registered). The more parameter is non-zero if there are
-            * leftover packets in the FIFO.
+    hal.compass_busy = 0;
+    hal.compass_done = 0;
+    if (!hal.compass_result) {
+        get_ms(&sensor_timestamp);
+        compass[0] = (long)hal.compass_short[0];
+        compass[1] = (long)hal.compass_short[1];
+        compass[2] = (long)hal.compass_short[2];
+        /* NOTE: If using a third-party compass calibration library,
+            * pass in the compass data in uT * 2^16 and set the second
+            * parameter to INV_CALIBRATED | acc, where acc is the
+            * accuracy from 0 to 3.
             */
-        dmp_read_fifo(gyro, accel_short, quat, &sensor_timestamp, &sensors, &more);
+        inv_build_compass(compass, 0, sensor_timestamp);
+    }
+    hal.new_data = 1;
+    execute_on_new_data();
+}
 
-        if (!more) {
-            hal.new_gyro = 0;
-        }
+/* TWI interrupt context. */
+static void compass_read_done(int result, short *data)
+{
+    hal.compass_result = result;
+    memcpy(hal.compass_short, data, sizeof(hal.compass_short));
+    if (app_sched_event_put(NULL, 0, compass_handler) != NRF_SUCCESS) {
+        hal.compass_done = 1;
+    }
+}
+#endif
 
-        if (sensors & INV_XYZ_GYRO) {
-            /* Push the new data to the MPL. */
-            inv_build_gyro(gyro, sensor_timestamp);
-            new_data = 1;
-            if (hal.new_temp) {
-                hal.new_temp = 0;
-                /* Temperature only used for gyro temp comp. */
-                mpu_get_temperature(&temperature, &sensor_timestamp);
-                inv_build_temp(temperature, sensor_timestamp);
-            }
-        }
-        if (sensors & INV_XYZ_ACCEL) {
-            accel[0] = (long)accel_short[0];
-            accel[1] = (long)accel_short[1];
-            accel[2] = (long)accel_short[2];
-            inv_build_accel(accel, 0, sensor_timestamp);
-            new_data = 1;
+/* Called with no FIFO or compass read in flight. Put the accel in low-power
+ * cycle mode with the motion interrupt, and the gyro and DMP to sleep. The
+ * driver keeps the previous configuration for exit_motion_int_mode.
+ */
+static void enter_motion_int_mode(void)
+{
+    sample_event_t event;
+    short status;
+
+    hal.motion_int_pending = 0;
+    hal.still_ms = 0;
+    if (m_platform_data->idle_cb) {
+        m_platform_data->idle_cb();
+    }
+
+    if (mpu_lp_motion_interrupt(WOM_THRESH_MG, 1, WOM_LPA_HZ)) {
+        MPL_LOGE("Could not enable the motion interrupt.\n");
+        return;
+    }
+    if (hal.batch_depth > 1) {
+        APP_ERROR_CHECK(app_timer_stop(m_fifo_drain_timer_id));
+    }
+    /* Drop the data ready interrupts from before the switch, then clear
+     * the latched interrupt so the next motion raises a new edge.
+     */
+    while (sample_ring_pop(&m_sample_ring, &event)) {
+    }
+    mpu_get_int_status(&status);
+    hal.new_gyro = 0;
+#ifdef COMPASS_ENABLED
+    hal.new_compass = 0;
+#endif
+    hal.motion_int_mode = 1;
+
+    /* Notify the MPL that contiguity was broken. */
+    inv_accel_was_turned_off();
+    inv_gyro_was_turned_off();
+    inv_compass_was_turned_off();
+    inv_quaternion_sensor_was_turned_off();
+    MPL_LOGI("No motion, waiting for the motion interrupt.\n");
+}
+
+/* The motion interrupt fired. Restore the sensors, sample rate, FIFO and DMP
+ * as they were, and restart the pipeline from a fresh FIFO.
+ */
+static void exit_motion_int_mode(void)
+{
+    mpu_lp_motion_interrupt(0, 0, 0);
+    hal.motion_int_mode = 0;
+    hal.new_gyro = 0;
+    /* The idle time is not a FIFO gap, the MPL was already told the data
+     * stopped. Start the timestamps over from the next interrupt.
+     */
+    hal.last_sample_ms = 0;
+    hal.fifo_draining = 0;
+    hal.drain_edges_valid = 0;
+    sample_clock_resync();
+    if (hal.dmp_on) {
+        /* Restarts the drain timer in batching mode. */
+        md612_set_batch_depth(hal.batch_depth);
+    }
+    MPL_LOGI("Motion, sensors back on.\n");
+}
+
+void md612_aftersleep()
+{
+    /* Reads whose handler didn't fit in the scheduler queue. */
+    if (hal.fifo_done) {
+        fifo_batch_handler(NULL, 0);
+    }
+#ifdef COMPASS_ENABLED
+    if (hal.compass_done) {
+        compass_handler(NULL, 0);
+    }
+#endif
+    /* While a read is in flight, fifo_batch_handler takes the events it
+     * covers.
+     */
+    if (!hal.fifo_busy && take_sample_events(UINT64_MAX)) {
+        hal.new_gyro = 1;
+    }
+    if (hal.motion_int_mode) {
+        /* Any interrupt now is the motion interrupt. */
+        if (hal.new_gyro) {
+            exit_motion_int_mode();
         }
-        if (sensors & INV_WXYZ_QUAT) {
-            inv_build_quat(quat, 0, sensor_timestamp);
-            new_data = 1;
+        return;
+    }
+    if (hal.motion_int_pending && !hal.fifo_busy
+#ifdef COMPASS_ENABLED
+        && !hal.compass_busy
+#endif
+        ) {
+        enter_motion_int_mode();
+        return;
+    }
+    if (hal.rates_pending && !hal.fifo_busy
+#ifdef COMPASS_ENABLED
+        && !hal.compass_busy
+#endif
+        ) {
+        apply_rates();
+    }
+    if (hal.new_gyro && hal.dmp_on) {
+        /* Start a non-blocking read of every packet in the FIFO. The CPU
+            * sleeps while the transfers run and fifo_batch_handler pushes
+            * the samples to the MPL once they are in RAM.
+            */
+        if (!hal.fifo_busy) {
+            hal.new_gyro = 0;
+            hal.fifo_busy = 1;
+            LATENCY_START((hal.batch_depth > 1) ?
+                hal.drain_ticks : hal.int_ticks);
+            LATENCY_MARK(LATENCY_WAKE);
+            if (dmp_read_fifo_async(fifo_read_done)) {
+                /* TWI queue is full, try again on the next pass. */
+                hal.fifo_busy = 0;
+                hal.new_gyro = 1;
+            }
         }
     } else if (hal.new_gyro) {
         short gyro[3], accel_short[3];
         unsigned char sensors, more;
         long accel[3], temperature;
+        unsigned long sensor_timestamp, overflows, resets;
+        uint64_t count_ticks;
         /* This function gets new data from the FIFO. The FIFO can contain
             * gyro, accel, both, or neither. The sensors parameter tells the
             * caller which data fields were actually populated with new data.
@@ -1139,14 +1783,45 @@ void md612_aftersleep()
             * information to increase the frequency at which this function is
             * called.
             */
+        PROFILE_START(start);
         hal.new_gyro = 0;
         mpu_read_fifo(gyro, accel_short, &sensor_timestamp, &sensors, &more);
+        PROFILE_STOP(start, mpu_read_fifo, "mpu_read_fifo");
+        count_ticks = timestamp_ticks();
         if (more)
             hal.new_gyro = 1;
+        /* mpu_read_fifo realigns the FIFO after an overflow without telling
+            * the caller, so check the driver's counter.
+            */
+        mpu_get_fifo_stats(&overflows, &resets);
+        if (overflows != hal.last_overflows) {
+            hal.last_overflows = overflows;
+            hal.fifo_gap = 1;
+        }
+        if (sensors) {
+            /* One packet per call, anchor at the start of each drain. */
+            if (!hal.fifo_draining) {
+                if (hal.fifo_gap) {
+                    sample_clock_resync();
+                }
+                sample_clock_anchor(fifo_anchor_us(count_ticks), more + 1);
+            }
+            hal.fifo_draining = more;
+            sensor_timestamp = (unsigned long)(sample_clock_next() / 1000);
+        }
+        if (sensors && hal.fifo_gap) {
+            if (hal.new_data) {
+                inv_execute_on_data();
+                hal.new_data = 0;
+            }
+            handle_fifo_gap(sensor_timestamp);
+        }
+        if (sensors)
+            hal.last_sample_ms = sensor_timestamp;
         if (sensors & INV_XYZ_GYRO) {
             /* Push the new data to the MPL. */
             inv_build_gyro(gyro, sensor_timestamp);
-            new_data = 1;
+            hal.new_data = 1;
             if (hal.new_temp) {
                 hal.new_temp = 0;
                 /* Temperature only used for gyro temp comp. */
@@ -1159,55 +1834,27 @@ void md612_aftersleep()
             accel[1] = (long)accel_short[1];
             accel[2] = (long)accel_short[2];
             inv_build_accel(accel, 0, sensor_timestamp);
-            new_data = 1;
+            hal.new_data = 1;
+        }
+#ifdef COMPASS_IN_FIFO
+        if (sensors & INV_XYZ_COMPASS) {
+            build_fifo_compass(sensor_timestamp);
         }
+#endif
+        execute_on_new_data();
     }
 #ifdef COMPASS_ENABLED
-    if (hal.new_compass) {
-        short compass_short[3];
-        long compass[3];
+    if (hal.new_compass && !hal.compass_busy) {
         hal.new_compass = 0;
         /* For any MPU device with an AKM on the auxiliary I2C bus, the raw
             * magnetometer registers are copied to special gyro registers.
             */
-        if (!mpu_get_compass_reg(compass_short, &sensor_timestamp)) {
-            compass[0] = (long)compass_short[0];
-            compass[1] = (long)compass_short[1];
-            compass[2] = (long)compass_short[2];
-            /* NOTE: If using a third-party compass calibration library,
-                * pass in the compass data in uT * 2^16 and set the second
-                * parameter to INV_CALIBRATED | acc, where acc is the
-                * accuracy from 0 to 3.
-                */
-            inv_build_compass(compass, 0, sensor_timestamp);
+        hal.compass_busy = 1;
+        if (mpu_get_compass_reg_async(compass_read_done)) {
+            hal.compass_busy = 0;
         }
-        new_data = 1;
     }
 #endif
-    if (new_data) {
-        if(inv_execute_on_data()) {
-            MPL_LOGE("ERROR execute on data\n");
-        }
-        
-        /* This function reads bias-compensated sensor data and sensor
-            * fusion outputs from the MPL. The outputs are formatted as seen
-            * in eMPL_outputs.c. This function only needs to be called at the
-            * rate requested by the host.
-            */
-
-        //DKW - Try Changing to Accel Data
-        if (hal.new_euler) {
-        	if (hal.motion) {
-        		read_from_mpl();
-        		hal.motion = 0;
-        	}
-        	// if there is not motion only send if the slow timme out has occured.
-        	else if (hal.new_euler == 2) {
-        		read_from_mpl();
-        	}
-        	hal.new_euler = 0;
-        }
-    }
 }
 
      //   if (new_accel) {
@@ -1224,7 +1871,46 @@ void md612_aftersleep()
         //    }
         //}
 
+void md612_get_fifo_stats(unsigned long *overflows, unsigned long *dropped,
+        unsigned long *resets, unsigned long *resyncs)
+{
+    mpu_get_fifo_stats(overflows, resets);
+    dmp_get_resync_count(resyncs);
+    *dropped = hal.fifo_dropped;
+}
+
+/* Deepest the interrupt ring has been when drained, the interrupts dropped
+ * because it was full, and the FIFO packets that came without an interrupt.
+ */
+void md612_get_event_stats(unsigned long *max_depth, unsigned long *dropped,
+        unsigned long *missed)
+{
+    *max_depth = m_sample_ring.high_water;
+    *dropped = m_sample_ring.dropped;
+    *missed = hal.missed_ints;
+}
+
 unsigned char md612_hasnewdata()
 {
-	return hal.sensors && hal.new_gyro;
+	if (hal.fifo_done) {
+		return 1;
+	}
+#ifdef COMPASS_ENABLED
+	if (hal.compass_done) {
+		return 1;
+	}
+	if (hal.new_compass && !hal.compass_busy) {
+		return 1;
+	}
+#endif
+	/* md612_aftersleep waits for both reads before acting on these. */
+	if ((hal.rates_pending || hal.motion_int_pending) && !hal.fifo_busy &&
+#ifdef COMPASS_ENABLED
+		!hal.compass_busy &&
+#endif
+		!hal.motion_int_mode) {
+		return 1;
+	}
+	return hal.sensors && !hal.fifo_busy &&
+		(hal.new_gyro || sample_ring_count(&m_sample_ring));
 }
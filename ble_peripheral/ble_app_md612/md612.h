@@ -14,18 +14,75 @@
 #define MOTION          (0)
 #define NO_MOTION       (1)
 
+/* Output sinks, see md612_subscribe. */
+#define MD612_SINK_CALLBACK     (0)     /* platform_data_t.cb */
+#define MD612_SINK_PACKET       (1)     /* eMPL packet over the log UART */
+
 /* Platform-specific information. Kinda like a boardfile. */
 typedef struct {
     void (*cb) (unsigned char type, long *data, int8_t accuracy, unsigned long timestamp);
+    /* Optional, called before the sensors sleep on no motion. Nothing more
+     * comes through cb until they wake up.
+     */
+    void (*idle_cb) (void);
+    /* Bit mask of the eMPL_packet_e types cb handles, 1 << PACKET_DATA_QUAT
+     * etc. md612_set_rates only publishes these.
+     */
+    unsigned short cb_types;
     signed char gyro_orientation[9];
     signed char compass_orientation[9];
     nrf_drv_gpiote_pin_t pin;
 } platform_data_t;
 
+/* Rates applied together by md612_set_rates. 0 keeps the current value. */
+#define MD612_MAX_PUBLISH       (4)
+
+typedef struct {
+    unsigned short sample_hz;   /* MPU sample rate, DMP off only */
+    unsigned short fifo_hz;     /* DMP FIFO rate, DMP on only, divides 200 */
+    unsigned short compass_hz;  /* Up to 100 and the MPU sample rate */
+    /* Publish divider of the callback subscriptions, see md612_subscribe. */
+    unsigned char publish_count;
+    struct {
+        unsigned char type;
+        unsigned char divider;
+    } publish[MD612_MAX_PUBLISH];
+} md612_rates_t;
+
 void md612_configure(platform_data_t const * platform_data);
 void md612_selftest();
+/* Number of samples to collect in the FIFO between wake-ups. Must be called
+ * after the scheduler is initialized. 1 wakes up on every sample.
+ */
+void md612_set_batch_depth(unsigned char depth);
+/* Subscribe a sink to an MPL output. type is one of eMPL_packet_e
+ * (PACKET_DATA_QUAT, etc), divider sends every Nth fusion result and 0
+ * unsubscribes. Returns -1 if the table is full.
+ */
+int md612_subscribe(unsigned char type, unsigned char sink,
+        unsigned char divider);
+/* Check and queue a new set of rates. They are applied together from
+ * md612_aftersleep once no FIFO read is in flight, and the MPL sample rates
+ * are resynced. The publish pairs subscribe the callback sink in order.
+ * Returns -1 if any rate is out of range, a type isn't in
+ * platform_data_t.cb_types, or the subscription table would overflow, and
+ * nothing is applied.
+ */
+int md612_set_rates(md612_rates_t const *rates);
 void md612_beforesleep();
 void md612_aftersleep();
 unsigned char md612_hasnewdata();
+/* FIFO loss counters: overflows, packets lost to overflows and resets (an
+ * estimate from the sample timestamps), FIFO resets, and misalignments
+ * recovered without a reset.
+ */
+void md612_get_fifo_stats(unsigned long *overflows, unsigned long *dropped,
+        unsigned long *resets, unsigned long *resyncs);
+/* Data ready interrupt queue: the most interrupts waiting for the main loop
+ * at once, a measure of how far it falls behind, the ones dropped, and the
+ * FIFO packets that came without one (see the sample_event_t edges).
+ */
+void md612_get_event_stats(unsigned long *max_depth, unsigned long *dropped,
+        unsigned long *missed);
 
 #endif
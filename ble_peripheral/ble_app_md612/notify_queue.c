@@ -0,0 +1,157 @@
+#include <string.h>
+#include "notify_queue.h"
+#include "nrf_error.h"
+#include "latency.h"
+
+typedef struct {
+    uint16_t handle;
+    uint16_t len;
+    uint8_t data[NOTIFY_QUEUE_MAX_LEN];
+} notify_entry_t;
+
+static struct {
+    notify_entry_t entries[NOTIFY_QUEUE_SIZE];
+    uint8_t head;
+    uint8_t count;
+    /* Queue depth for this link, the SoftDevice TX buffer count. */
+    uint8_t depth;
+    /* SoftDevice TX buffers of the link, and how many are free as far as
+     * we know. Other services' notifications use them too, so this can be
+     * off until the next BLE_ERROR_NO_TX_PACKETS or TX complete.
+     */
+    uint8_t buffers;
+    uint8_t credits;
+    uint8_t policy;
+    uint16_t conn_handle;
+    notify_queue_stats_t stats;
+} m_queue;
+
+void notify_queue_init(uint8_t policy)
+{
+    memset(&m_queue, 0, sizeof(m_queue));
+    m_queue.policy = policy;
+    m_queue.conn_handle = BLE_CONN_HANDLE_INVALID;
+}
+
+void notify_queue_set_policy(uint8_t policy)
+{
+    m_queue.policy = policy;
+}
+
+/* Hand the waiting notifications to the SoftDevice while it has buffers. */
+static void notify_queue_pump(void)
+{
+    ble_gatts_hvx_params_t hvx_params;
+    notify_entry_t *entry;
+    uint16_t len;
+    uint32_t err_code;
+
+    while (m_queue.count && m_queue.credits) {
+        entry = &m_queue.entries[m_queue.head];
+        len = entry->len;
+        memset(&hvx_params, 0, sizeof(hvx_params));
+        hvx_params.handle = entry->handle;
+        hvx_params.type = BLE_GATT_HVX_NOTIFICATION;
+        hvx_params.offset = 0;
+        hvx_params.p_len = &len;
+        hvx_params.p_data = entry->data;
+        err_code = sd_ble_gatts_hvx(m_queue.conn_handle, &hvx_params);
+        if (err_code == BLE_ERROR_NO_TX_PACKETS) {
+            /* Someone else took the buffers, wait for a TX complete. */
+            m_queue.credits = 0;
+            break;
+        }
+        if (err_code == NRF_SUCCESS) {
+            LATENCY_MARK(LATENCY_NOTIFY);
+            m_queue.credits--;
+            m_queue.stats.sent++;
+        } else {
+            m_queue.stats.failed++;
+        }
+        m_queue.head = (m_queue.head + 1) % NOTIFY_QUEUE_SIZE;
+        m_queue.count--;
+    }
+}
+
+void notify_queue_on_ble_evt(ble_evt_t * p_ble_evt)
+{
+    uint8_t count;
+
+    switch (p_ble_evt->header.evt_id) {
+    case BLE_GAP_EVT_CONNECTED:
+        m_queue.conn_handle = p_ble_evt->evt.gap_evt.conn_handle;
+        m_queue.head = 0;
+        m_queue.count = 0;
+        if (sd_ble_tx_packet_count_get(m_queue.conn_handle, &count) ||
+            !count) {
+            count = 1;
+        }
+        m_queue.buffers = count;
+        m_queue.credits = count;
+        m_queue.depth = (count < NOTIFY_QUEUE_SIZE) ? count : NOTIFY_QUEUE_SIZE;
+        break;
+
+    case BLE_GAP_EVT_DISCONNECTED:
+        m_queue.conn_handle = BLE_CONN_HANDLE_INVALID;
+        m_queue.count = 0;
+        break;
+
+    case BLE_EVT_TX_COMPLETE:
+        count = p_ble_evt->evt.common_evt.params.tx_complete.count;
+        if ((m_queue.credits + count) > m_queue.buffers) {
+            m_queue.credits = m_queue.buffers;
+        } else {
+            m_queue.credits += count;
+        }
+        notify_queue_pump();
+        break;
+
+    default:
+        break;
+    }
+}
+
+uint32_t notify_queue_send(uint16_t handle, uint8_t const * p_data,
+        uint16_t len)
+{
+    notify_entry_t *entry;
+
+    if (m_queue.conn_handle == BLE_CONN_HANDLE_INVALID) {
+        return NRF_ERROR_INVALID_STATE;
+    }
+    if (len > NOTIFY_QUEUE_MAX_LEN) {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    /* Anything still waiting has no TX buffer to go to. */
+    if (m_queue.count && (m_queue.policy == NOTIFY_QUEUE_COALESCE)) {
+        m_queue.stats.coalesced += m_queue.count;
+        m_queue.count = 0;
+    } else if (m_queue.count >= m_queue.depth) {
+        if (m_queue.policy == NOTIFY_QUEUE_BLOCK) {
+            m_queue.stats.blocked++;
+            return NRF_ERROR_BUSY;
+        }
+        m_queue.head = (m_queue.head + 1) % NOTIFY_QUEUE_SIZE;
+        m_queue.count--;
+        m_queue.stats.dropped++;
+    }
+
+    entry = &m_queue.entries[(m_queue.head + m_queue.count) % NOTIFY_QUEUE_SIZE];
+    entry->handle = handle;
+    entry->len = len;
+    memcpy(entry->data, p_data, len);
+    m_queue.count++;
+    m_queue.stats.queued++;
+    if (m_queue.count > m_queue.stats.max_depth) {
+        m_queue.stats.max_depth = m_queue.count;
+    }
+
+    notify_queue_pump();
+    return NRF_SUCCESS;
+}
+
+void notify_queue_get_stats(notify_queue_stats_t * p_stats)
+{
+    *p_stats = m_queue.stats;
+}
@@ -0,0 +1,57 @@
+#ifndef __NOTIFY_QUEUE__
+#define __NOTIFY_QUEUE__
+
+#include <stdint.h>
+#include "ble.h"
+
+/* Notifications waiting for a SoftDevice TX buffer. The queue is as deep as
+ * the SoftDevice TX buffer count of the link (up to NOTIFY_QUEUE_SIZE), and
+ * is pumped on BLE_EVT_TX_COMPLETE. What happens when it is full depends on
+ * the policy:
+ * DROP_OLDEST  the oldest waiting notification makes room for the new one.
+ * COALESCE     only the newest notification waits, so under congestion the
+ *              next one out is always the latest.
+ * BLOCK        the queue keeps what it has and refuses the new one, the
+ *              caller gets NRF_ERROR_BUSY.
+ */
+#define NOTIFY_QUEUE_DROP_OLDEST    (0)
+#define NOTIFY_QUEUE_COALESCE       (1)
+#define NOTIFY_QUEUE_BLOCK          (2)
+
+#define NOTIFY_QUEUE_SIZE           (8)
+/* Largest notification, an ATT MTU of 247. */
+#define NOTIFY_QUEUE_MAX_LEN        (244)
+
+typedef struct {
+    /* Accepted by notify_queue_send. */
+    uint32_t queued;
+    uint32_t sent;
+    /* Waiting notifications replaced by DROP_OLDEST and COALESCE. */
+    uint32_t dropped;
+    uint32_t coalesced;
+    /* Refused by BLOCK. */
+    uint32_t blocked;
+    /* Rejected by the SoftDevice for another reason than no TX buffer,
+     * e.g. notifications not enabled.
+     */
+    uint32_t failed;
+    uint8_t max_depth;
+} notify_queue_stats_t;
+
+void notify_queue_init(uint8_t policy);
+
+void notify_queue_set_policy(uint8_t policy);
+
+/* Tracks the connection and the TX buffers. Feed every BLE event. */
+void notify_queue_on_ble_evt(ble_evt_t * p_ble_evt);
+
+/* Send a notification on the connected link, or queue it. Returns
+ * NRF_ERROR_INVALID_STATE if not connected, NRF_ERROR_INVALID_LENGTH if
+ * len is over NOTIFY_QUEUE_MAX_LEN and NRF_ERROR_BUSY if refused by BLOCK.
+ */
+uint32_t notify_queue_send(uint16_t handle, uint8_t const * p_data,
+        uint16_t len);
+
+void notify_queue_get_stats(notify_queue_stats_t * p_stats);
+
+#endif
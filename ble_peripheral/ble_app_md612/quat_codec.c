@@ -0,0 +1,178 @@
+#include <string.h>
+#include "quat_codec.h"
+
+/* 1.0 squared in Q14. */
+#define QUAT_CODEC_ONE_SQ   (1UL << 28)
+
+#define HEADER_SEQ          (0)
+#define HEADER_TIMESTAMP    (2)
+#define HEADER_COUNT        (6)
+#define HEADER_QUAT         (7)
+#define HEADER_ACCEL        (13)
+
+static void put_u16(uint8_t *p_buf, uint16_t value)
+{
+    p_buf[0] = (uint8_t)value;
+    p_buf[1] = (uint8_t)(value >> 8);
+}
+
+static void put_u32(uint8_t *p_buf, uint32_t value)
+{
+    put_u16(p_buf, (uint16_t)value);
+    put_u16(p_buf + 2, (uint16_t)(value >> 16));
+}
+
+static uint8_t put_varint(uint8_t *p_buf, uint32_t value)
+{
+    uint8_t len = 0;
+
+    while (value >= 0x80) {
+        p_buf[len++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    p_buf[len++] = (uint8_t)value;
+    return len;
+}
+
+/* Small deltas of either sign get short varints. */
+static uint32_t zigzag(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+/* floor(sqrt(value)). */
+static uint32_t isqrt(uint32_t value)
+{
+    uint32_t root = 0;
+    uint32_t bit = 1UL << 30;
+
+    while (bit > value) {
+        bit >>= 2;
+    }
+    while (bit) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+/* Write the smallest three of quat and keep the quaternion the decoder
+ * rebuilds from them.
+ */
+static void put_keyframe(quat_codec_t *p_codec, uint8_t *p_buf,
+        int16_t const *quat)
+{
+    int32_t q[4], small;
+    uint32_t sum = 0;
+    uint64_t bits;
+    uint8_t ii, largest = 0, shift = 2;
+
+    for (ii = 0; ii < 4; ii++) {
+        q[ii] = quat[ii];
+        if (((q[ii] < 0) ? -q[ii] : q[ii]) >
+            ((q[largest] < 0) ? -q[largest] : q[largest])) {
+            largest = ii;
+        }
+    }
+    if (q[largest] < 0) {
+        for (ii = 0; ii < 4; ii++) {
+            q[ii] = -q[ii];
+        }
+    }
+
+    bits = largest;
+    for (ii = 0; ii < 4; ii++) {
+        if (ii == largest) {
+            continue;
+        }
+        small = q[ii];
+        /* Only reachable with a quaternion that is far from unit. */
+        if (small > 16383) {
+            small = 16383;
+        } else if (small < -16384) {
+            small = -16384;
+        }
+        p_codec->quat[ii] = (int16_t)small;
+        sum += (uint32_t)(small * small);
+        bits |= (uint64_t)((uint32_t)small & 0x7FFF) << shift;
+        shift += 15;
+    }
+    p_codec->quat[largest] = (int16_t)((sum < QUAT_CODEC_ONE_SQ) ?
+        isqrt(QUAT_CODEC_ONE_SQ - sum) : 0);
+
+    for (ii = 0; ii < 6; ii++) {
+        p_buf[ii] = (uint8_t)(bits >> (8 * ii));
+    }
+}
+
+void quat_codec_init(quat_codec_t *p_codec, uint8_t *p_buf, uint16_t size)
+{
+    memset(p_codec, 0, sizeof(*p_codec));
+    p_codec->p_buf = p_buf;
+    p_codec->size = size;
+}
+
+int quat_codec_add(quat_codec_t *p_codec, uint16_t seq, uint32_t timestamp_ms,
+        int16_t const *quat, int16_t const *accel)
+{
+    uint8_t entry[QUAT_CODEC_MAX_DELTA_LEN];
+    int16_t q[4];
+    int32_t dot = 0;
+    uint8_t ii, len;
+
+    if (!p_codec->count) {
+        if (p_codec->size < QUAT_CODEC_KEY_LEN) {
+            return -1;
+        }
+        put_u16(&p_codec->p_buf[HEADER_SEQ], seq);
+        put_u32(&p_codec->p_buf[HEADER_TIMESTAMP], timestamp_ms);
+        put_keyframe(p_codec, &p_codec->p_buf[HEADER_QUAT], quat);
+        for (ii = 0; ii < 3; ii++) {
+            put_u16(&p_codec->p_buf[HEADER_ACCEL + 2 * ii], (uint16_t)accel[ii]);
+            p_codec->accel[ii] = accel[ii];
+        }
+        p_codec->len = QUAT_CODEC_KEY_LEN;
+        p_codec->last_ms = timestamp_ms;
+        p_codec->count = 1;
+        p_codec->p_buf[HEADER_COUNT] = 1;
+        return 0;
+    }
+    if (p_codec->count == 0xFF) {
+        return -1;
+    }
+
+    /* Stay on the same side as the previous sample. */
+    for (ii = 0; ii < 4; ii++) {
+        dot += (int32_t)quat[ii] * p_codec->quat[ii];
+    }
+    for (ii = 0; ii < 4; ii++) {
+        q[ii] = (dot < 0) ? (int16_t)-quat[ii] : quat[ii];
+    }
+
+    len = put_varint(entry, timestamp_ms - p_codec->last_ms);
+    for (ii = 0; ii < 4; ii++) {
+        len += put_varint(&entry[len],
+            zigzag((int32_t)q[ii] - p_codec->quat[ii]));
+    }
+    for (ii = 0; ii < 3; ii++) {
+        len += put_varint(&entry[len],
+            zigzag((int32_t)accel[ii] - p_codec->accel[ii]));
+    }
+    if ((p_codec->len + len) > p_codec->size) {
+        return -1;
+    }
+
+    memcpy(&p_codec->p_buf[p_codec->len], entry, len);
+    p_codec->len += len;
+    p_codec->last_ms = timestamp_ms;
+    memcpy(p_codec->quat, q, sizeof(q));
+    memcpy(p_codec->accel, accel, sizeof(p_codec->accel));
+    p_codec->count++;
+    p_codec->p_buf[HEADER_COUNT] = p_codec->count;
+    return 0;
+}
@@ -0,0 +1,55 @@
+#ifndef __QUAT_CODEC__
+#define __QUAT_CODEC__
+
+#include <stdint.h>
+
+/* Compressed stream of quaternion and linear acceleration samples. Each
+ * block starts with a keyframe, so it decodes on its own and a lost block
+ * only loses its own samples. All fields little-endian:
+ *   offset  0  uint16  sequence number of the first sample
+ *   offset  2  uint32  timestamp of the first sample (ms)
+ *   offset  6  uint8   number of samples
+ *   offset  7  48 bits keyframe quaternion, smallest three: bits 0-1 index
+ *                      of the largest component, then the three others in
+ *                      order as 15-bit two's complement Q14, from bit 2, 17
+ *                      and 32. The largest is positive and is recovered as
+ *                      isqrt(2^28 - a^2 - b^2 - c^2).
+ *   offset 13  int16   keyframe linear acceleration x, y, z (mg)
+ *   offset 19  one entry per following sample, all unsigned LEB128 varints:
+ *              time since the previous sample (ms), then zig-zag deltas of
+ *              the quaternion w, x, y, z (Q14) and of the linear
+ *              acceleration x, y, z (mg) from the previous sample.
+ * The deltas are taken from the decoded previous sample, so the decoder
+ * doesn't drift from the encoder. Only the keyframe quaternion is lossy, its
+ * largest component is rebuilt from the norm and is within 2 LSB of the
+ * input, see test/quat_codec_test.c. q and -q are the same rotation: the
+ * quaternions are sign-flipped to stay continuous with the keyframe, whose
+ * largest component is positive.
+ */
+#define QUAT_CODEC_KEY_LEN          (19)
+/* Longest sample entry: a 5 byte time and seven 3 byte deltas. */
+#define QUAT_CODEC_MAX_DELTA_LEN    (26)
+
+typedef struct {
+    uint8_t *p_buf;
+    uint16_t size;
+    uint16_t len;
+    uint8_t count;
+    /* Previous sample as the decoder sees it. */
+    uint32_t last_ms;
+    int16_t quat[4];
+    int16_t accel[3];
+} quat_codec_t;
+
+/* Start a new block in p_buf, the next sample is a keyframe. size must be at
+ * least QUAT_CODEC_KEY_LEN.
+ */
+void quat_codec_init(quat_codec_t *p_codec, uint8_t *p_buf, uint16_t size);
+
+/* Append a sample, quat is w, x, y, z in Q14 and accel in mg. Returns -1 if
+ * it doesn't fit or the block has 255 samples, nothing is added then.
+ */
+int quat_codec_add(quat_codec_t *p_codec, uint16_t seq, uint32_t timestamp_ms,
+        int16_t const *quat, int16_t const *accel);
+
+#endif
@@ -0,0 +1,118 @@
+#include "sample_clock.h"
+
+/* Times and periods are kept in 1/256 us, so the back-filled timestamps
+ * don't accumulate rounding errors over a batch.
+ */
+#define SAMPLE_CLOCK_FRAC_BITS      (8)
+/* Loop gains, as right shifts of the error: the phase follows the anchors
+ * with 1/8 of the error, the period with 1/32 of the error per sample.
+ */
+#define SAMPLE_CLOCK_PHASE_SHIFT    (3)
+#define SAMPLE_CLOCK_PERIOD_SHIFT   (5)
+/* The MPU oscillator is within a few percent of nominal. Keep the estimate
+ * within 1/20 (5%) of it.
+ */
+#define SAMPLE_CLOCK_PERIOD_RANGE   (20)
+/* An error of more than this many periods means samples were lost without
+ * a gap being reported. Start over from the anchor.
+ */
+#define SAMPLE_CLOCK_RELOCK_PERIODS (4)
+
+static struct {
+    /* Predicted time of the next sample to be stamped. */
+    uint64_t next;
+    uint32_t period;
+    uint32_t nominal;
+    /* Samples anchored but not stamped yet. */
+    uint16_t unstamped;
+    uint8_t locked;
+} m_clock;
+
+void sample_clock_init(uint16_t rate_hz)
+{
+    if (!rate_hz) {
+        return;
+    }
+    m_clock.nominal = ((1000000UL << SAMPLE_CLOCK_FRAC_BITS) + rate_hz / 2) /
+        rate_hz;
+    m_clock.period = m_clock.nominal;
+    m_clock.unstamped = 0;
+    m_clock.locked = 0;
+}
+
+void sample_clock_resync(void)
+{
+    m_clock.locked = 0;
+}
+
+void sample_clock_anchor(uint64_t anchor_us, uint16_t count)
+{
+    uint64_t anchor, first;
+    int64_t error = 0;
+    uint16_t span;
+    uint32_t limit;
+
+    if (!count || !m_clock.period) {
+        return;
+    }
+    anchor = anchor_us << SAMPLE_CLOCK_FRAC_BITS;
+    first = anchor - (uint64_t)(count - 1) * m_clock.period;
+
+    if (m_clock.locked) {
+        error = (int64_t)(first - m_clock.next);
+        if ((error > (int64_t)m_clock.period * SAMPLE_CLOCK_RELOCK_PERIODS) ||
+            (error < -(int64_t)m_clock.period * SAMPLE_CLOCK_RELOCK_PERIODS)) {
+            m_clock.locked = 0;
+        }
+    }
+    if (!m_clock.locked) {
+        /* Never step back over samples already stamped. */
+        if ((first > m_clock.next) || !m_clock.next) {
+            m_clock.next = first;
+        }
+        m_clock.unstamped = count;
+        m_clock.locked = 1;
+        return;
+    }
+
+    m_clock.next += error >> SAMPLE_CLOCK_PHASE_SHIFT;
+
+    /* The error built up over the samples written since the last anchor. */
+    span = (count > m_clock.unstamped) ? (count - m_clock.unstamped) : 0;
+    if (span) {
+        m_clock.period += (error / span) >> SAMPLE_CLOCK_PERIOD_SHIFT;
+        limit = m_clock.nominal / SAMPLE_CLOCK_PERIOD_RANGE;
+        if (m_clock.period > m_clock.nominal + limit) {
+            m_clock.period = m_clock.nominal + limit;
+        } else if (m_clock.period < m_clock.nominal - limit) {
+            m_clock.period = m_clock.nominal - limit;
+        }
+    }
+    m_clock.unstamped = count;
+}
+
+uint64_t sample_clock_next(void)
+{
+    uint64_t timestamp;
+
+    timestamp = m_clock.next >> SAMPLE_CLOCK_FRAC_BITS;
+    m_clock.next += m_clock.period;
+    if (m_clock.unstamped) {
+        m_clock.unstamped--;
+    }
+    return timestamp;
+}
+
+uint32_t sample_clock_period_us(void)
+{
+    return m_clock.period >> SAMPLE_CLOCK_FRAC_BITS;
+}
+
+uint32_t sample_clock_rate_mhz(void)
+{
+    if (!m_clock.period) {
+        return 0;
+    }
+    return (uint32_t)(((1000000000ULL << SAMPLE_CLOCK_FRAC_BITS) +
+        m_clock.period / 2) / m_clock.period);
+}
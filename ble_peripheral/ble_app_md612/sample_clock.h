@@ -0,0 +1,38 @@
+#ifndef __SAMPLE_CLOCK__
+#define __SAMPLE_CLOCK__
+
+#include <stdint.h>
+
+/* Reconstructs the time each FIFO sample was taken. The MPU samples on its
+ * own oscillator, which can be a few percent off the configured rate, so the
+ * real sample period is tracked against the nRF RTC: every FIFO drain is
+ * anchored to the time its newest sample was written, and the difference
+ * with the predicted time corrects both the phase and the period.
+ */
+
+/* Nominal rate from mpu_get_sample_rate or dmp_get_fifo_rate. Drops the
+ * lock and the period estimate.
+ */
+void sample_clock_init(uint16_t rate_hz);
+
+/* The samples are no longer contiguous (FIFO overflow or reset). The next
+ * anchor sets the phase, the period estimate is kept.
+ */
+void sample_clock_resync(void);
+
+/* Start of a FIFO drain. anchor_us is the time the newest sample in the FIFO
+ * was written and count the number of samples from the next one to be
+ * stamped up to it.
+ */
+void sample_clock_anchor(uint64_t anchor_us, uint16_t count);
+
+/* Timestamp of the next sample in the FIFO, in microseconds. */
+uint64_t sample_clock_next(void);
+
+/* Estimated sample period in microseconds. */
+uint32_t sample_clock_period_us(void);
+
+/* Estimated sample rate in mHz. */
+uint32_t sample_clock_rate_mhz(void);
+
+#endif
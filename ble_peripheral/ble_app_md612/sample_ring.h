@@ -0,0 +1,103 @@
+#ifndef __SAMPLE_RING__
+#define __SAMPLE_RING__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Single-producer/single-consumer ring of data ready events, filled by the
+ * GPIOTE interrupt and drained by the main loop. The producer only writes
+ * head and the consumer only writes tail, so no lock is needed: a barrier
+ * between the slot and the index update orders the two. Builds on the host
+ * as well, with the compiler's full barrier.
+ */
+#if defined(__arm__)
+#include "nrf.h"
+#define SAMPLE_RING_BARRIER()   __DMB()
+#else
+#define SAMPLE_RING_BARRIER()   __sync_synchronize()
+#endif
+
+/* Must be a power of two. */
+#define SAMPLE_RING_SIZE        (16)
+#define SAMPLE_RING_MASK        (SAMPLE_RING_SIZE - 1)
+
+typedef struct {
+    /* RTC time of the interrupt, see timestamp_ticks. */
+    uint64_t ticks;
+    /* Running count of interrupts, including the ones dropped on a full
+     * ring. The difference between two events is the number of packets
+     * written to the FIFO in between.
+     */
+    uint16_t edges;
+} sample_event_t;
+
+typedef struct {
+    sample_event_t events[SAMPLE_RING_SIZE];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    /* Producer side. */
+    volatile uint32_t dropped;
+    uint16_t edges;
+    /* Consumer side, deepest the ring has been when drained. */
+    uint32_t high_water;
+} sample_ring_t;
+
+/* Producer. Returns false if the ring is full and the event was dropped. */
+static inline bool sample_ring_push(sample_ring_t *ring, uint64_t ticks)
+{
+    uint32_t head = ring->head;
+
+    ring->edges++;
+    if ((head - ring->tail) >= SAMPLE_RING_SIZE) {
+        ring->dropped++;
+        return false;
+    }
+    ring->events[head & SAMPLE_RING_MASK].ticks = ticks;
+    ring->events[head & SAMPLE_RING_MASK].edges = ring->edges;
+    SAMPLE_RING_BARRIER();
+    ring->head = head + 1;
+    return true;
+}
+
+/* Consumer. Number of events waiting. */
+static inline uint32_t sample_ring_count(sample_ring_t const *ring)
+{
+    return ring->head - ring->tail;
+}
+
+/* Consumer. Oldest event, left in the ring. Returns false if the ring is
+ * empty.
+ */
+static inline bool sample_ring_peek(sample_ring_t const *ring,
+        sample_event_t *event)
+{
+    uint32_t tail = ring->tail;
+
+    if (tail == ring->head) {
+        return false;
+    }
+    SAMPLE_RING_BARRIER();
+    *event = ring->events[tail & SAMPLE_RING_MASK];
+    return true;
+}
+
+/* Consumer. Returns false if the ring is empty. */
+static inline bool sample_ring_pop(sample_ring_t *ring, sample_event_t *event)
+{
+    uint32_t tail = ring->tail;
+    uint32_t depth = ring->head - tail;
+
+    if (!depth) {
+        return false;
+    }
+    if (depth > ring->high_water) {
+        ring->high_water = depth;
+    }
+    SAMPLE_RING_BARRIER();
+    *event = ring->events[tail & SAMPLE_RING_MASK];
+    SAMPLE_RING_BARRIER();
+    ring->tail = tail + 1;
+    return true;
+}
+
+#endif
@@ -0,0 +1,203 @@
+/* Round trip of quat_codec through the reference decoder: make -C test
+ *
+ *   quat_codec_test encode REF > HEX
+ *   mde_decode.py --compressed HEX | quat_codec_test check REF
+ *
+ * encode writes one compressed block per line, as hex, and the samples that
+ * went in to REF. check reads the decoded samples and compares them with REF.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "quat_codec.h"
+
+/* The keyframe quaternion is rebuilt from the unit norm, so it is off by as
+ * much as the Q14 rounding moved the norm away from 1. Every other field and
+ * every later sample, taken as deltas from the rebuilt keyframe, is exact.
+ */
+#define KEY_QUAT_TOLERANCE  (2)
+
+#define NUM_SAMPLES         (3000)
+
+typedef struct {
+    uint16_t seq;
+    uint32_t timestamp;
+    int16_t quat[4];
+    int16_t accel[3];
+    int key;
+} sample_t;
+
+/* Sample ii of a rotation about a slowly wandering axis, with a fast spin
+ * and large accel steps now and then, and jumps in time and sequence. */
+static void make_sample(unsigned int ii, sample_t *sample, uint32_t *timestamp)
+{
+    static double angle;
+    double axis[3], norm, rate;
+    unsigned int jj;
+
+    axis[0] = sin(ii * 0.003);
+    axis[1] = cos(ii * 0.005);
+    axis[2] = sin(ii * 0.007 + 1.0);
+    norm = sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    /* Fast enough in places to cross hemispheres and need long varints. */
+    rate = ((ii / 500) % 2) ? 0.2 : 0.01;
+    angle += rate;
+
+    sample->quat[0] = (int16_t)lrint(16384 * cos(angle / 2));
+    for (jj = 0; jj < 3; jj++) {
+        sample->quat[jj + 1] =
+            (int16_t)lrint(16384 * sin(angle / 2) * axis[jj] / norm);
+    }
+    for (jj = 0; jj < 3; jj++) {
+        sample->accel[jj] = (int16_t)(2000 * sin(ii * (0.05 + 0.02 * jj)));
+    }
+    if ((ii % 97) == 0) {
+        sample->accel[ii % 3] = (ii % 2) ? 32767 : -32768;
+    }
+
+    *timestamp += ((ii % 211) == 0) ? 100000 : 5;
+    sample->timestamp = *timestamp;
+    sample->seq = (uint16_t)(65000 + ii);
+}
+
+static void print_block(quat_codec_t const *codec)
+{
+    uint16_t ii;
+
+    for (ii = 0; ii < codec->len; ii++) {
+        printf("%02x", codec->p_buf[ii]);
+    }
+    printf("\n");
+}
+
+/* Encode the stream in blocks of size bytes and of at most max_count
+ * samples, like ble_mde_compressed_add. */
+static void encode(FILE *ref, uint16_t size, uint16_t max_count,
+        uint32_t *timestamp, unsigned int first)
+{
+    static uint8_t buf[4096];
+    quat_codec_t codec;
+    sample_t sample;
+    unsigned int ii;
+
+    quat_codec_init(&codec, buf, size);
+    for (ii = first; ii < first + NUM_SAMPLES; ii++) {
+        make_sample(ii, &sample, timestamp);
+        if (codec.count && quat_codec_add(&codec, sample.seq,
+                sample.timestamp, sample.quat, sample.accel)) {
+            print_block(&codec);
+            codec.count = 0;
+        }
+        sample.key = !codec.count;
+        if (!codec.count) {
+            quat_codec_init(&codec, buf, size);
+            if (quat_codec_add(&codec, sample.seq, sample.timestamp,
+                    sample.quat, sample.accel)) {
+                fprintf(stderr, "keyframe doesn't fit\n");
+                exit(1);
+            }
+        }
+        fprintf(ref, "%u %u %d %d %d %d %d %d %d %d\n", sample.seq,
+            sample.timestamp, sample.quat[0], sample.quat[1],
+            sample.quat[2], sample.quat[3], sample.accel[0],
+            sample.accel[1], sample.accel[2], sample.key);
+        if (codec.count >= max_count) {
+            print_block(&codec);
+            codec.count = 0;
+        }
+    }
+    if (codec.count) {
+        print_block(&codec);
+    }
+}
+
+static int check(FILE *ref)
+{
+    sample_t want, got;
+    unsigned int seq, timestamp, count = 0, failures = 0, jj;
+    int key, err, err_neg, max_err = 0;
+
+    while (fscanf(ref, "%u %u %hd %hd %hd %hd %hd %hd %hd %d", &seq,
+            &timestamp, &want.quat[0], &want.quat[1], &want.quat[2],
+            &want.quat[3], &want.accel[0], &want.accel[1], &want.accel[2],
+            &key) == 10) {
+        want.seq = seq;
+        want.timestamp = timestamp;
+        if (scanf("%u %u %hd %hd %hd %hd %hd %hd %hd", &seq, &timestamp,
+                &got.quat[0], &got.quat[1], &got.quat[2], &got.quat[3],
+                &got.accel[0], &got.accel[1], &got.accel[2]) != 9) {
+            printf("quat_codec: %u samples decoded, expected more\n", count);
+            return 1;
+        }
+        got.seq = seq;
+        got.timestamp = timestamp;
+        count++;
+
+        /* q and -q are the same rotation. */
+        err = err_neg = 0;
+        for (jj = 0; jj < 4; jj++) {
+            if (abs(got.quat[jj] - want.quat[jj]) > err) {
+                err = abs(got.quat[jj] - want.quat[jj]);
+            }
+            if (abs(got.quat[jj] + want.quat[jj]) > err_neg) {
+                err_neg = abs(got.quat[jj] + want.quat[jj]);
+            }
+        }
+        if (err_neg < err) {
+            err = err_neg;
+        }
+        if (key && (err > max_err)) {
+            max_err = err;
+        }
+        if ((got.seq != want.seq) || (got.timestamp != want.timestamp) ||
+            memcmp(got.accel, want.accel, sizeof(got.accel)) ||
+            (err > (key ? KEY_QUAT_TOLERANCE : 0))) {
+            if (failures++ < 10) {
+                printf("quat_codec: sample %u seq %u: quat err %d\n",
+                    count - 1, want.seq, err);
+            }
+        }
+    }
+    if (scanf("%u", &seq) == 1) {
+        printf("quat_codec: more samples decoded than encoded\n");
+        return 1;
+    }
+    if (failures) {
+        printf("quat_codec: %u of %u samples wrong\n", failures, count);
+        return 1;
+    }
+    printf("quat_codec: ok, %u samples, keyframe quaternion within %d LSB\n",
+        count, max_err);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    FILE *ref;
+    uint32_t timestamp = 0xFFFF0000UL;
+    int result;
+
+    if ((argc != 3) || (strcmp(argv[1], "encode") && strcmp(argv[1], "check"))) {
+        fprintf(stderr, "usage: %s encode|check REF\n", argv[0]);
+        return 2;
+    }
+    ref = fopen(argv[2], (argv[1][0] == 'e') ? "w" : "r");
+    if (!ref) {
+        perror(argv[2]);
+        return 2;
+    }
+    if (argv[1][0] == 'e') {
+        /* ATT MTU 247 with the 20 ms budget at 200 Hz, the full MTU, and a
+         * large buffer for the 255 sample limit. The timestamps wrap. */
+        encode(ref, 244, 4, &timestamp, 0);
+        encode(ref, 244, 255, &timestamp, NUM_SAMPLES);
+        encode(ref, 20, 255, &timestamp, 2 * NUM_SAMPLES);
+        encode(ref, 4096, 255, &timestamp, 3 * NUM_SAMPLES);
+        result = 0;
+    } else {
+        result = check(ref);
+    }
+    fclose(ref);
+    return result;
+}
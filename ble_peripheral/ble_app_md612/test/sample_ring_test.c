@@ -0,0 +1,121 @@
+/* Host test of sample_ring.h: make -C test */
+#include <stdio.h>
+#include "sample_ring.h"
+
+static int m_failures;
+
+#define CHECK(COND) do { \
+    if (!(COND)) { \
+        printf("%s:%d: %s\n", __FILE__, __LINE__, #COND); \
+        m_failures++; \
+    } \
+} while (0)
+
+/* Events come out in the order they went in, with running edge counts. */
+static void test_order(void)
+{
+    sample_ring_t ring = {0};
+    sample_event_t event;
+    uint64_t ii;
+
+    CHECK(!sample_ring_pop(&ring, &event));
+    CHECK(!sample_ring_peek(&ring, &event));
+    for (ii = 0; ii < 5; ii++) {
+        CHECK(sample_ring_push(&ring, 100 + ii));
+    }
+    CHECK(sample_ring_count(&ring) == 5);
+    CHECK(sample_ring_peek(&ring, &event) && (event.ticks == 100));
+    CHECK(sample_ring_count(&ring) == 5);
+    for (ii = 0; ii < 5; ii++) {
+        CHECK(sample_ring_pop(&ring, &event));
+        CHECK(event.ticks == 100 + ii);
+        CHECK(event.edges == ii + 1);
+    }
+    CHECK(!sample_ring_pop(&ring, &event));
+    CHECK(ring.high_water == 5);
+}
+
+/* The indices run past the size many times over. */
+static void test_wrap(void)
+{
+    sample_ring_t ring = {0};
+    sample_event_t event;
+    uint64_t next = 0, expected = 0;
+    unsigned int round, ii;
+
+    for (round = 0; round < 10 * SAMPLE_RING_SIZE; round++) {
+        for (ii = 0; ii < 3; ii++) {
+            CHECK(sample_ring_push(&ring, next++));
+        }
+        for (ii = 0; ii < 3; ii++) {
+            CHECK(sample_ring_pop(&ring, &event));
+            CHECK(event.ticks == expected);
+            expected++;
+        }
+    }
+    CHECK(sample_ring_count(&ring) == 0);
+    CHECK(ring.dropped == 0);
+    CHECK(ring.high_water == 3);
+}
+
+/* A full ring drops the new events, counts them, and still counts their
+ * edges, so the edges of the next event tell how many were missed.
+ */
+static void test_full(void)
+{
+    sample_ring_t ring = {0};
+    sample_event_t event;
+    unsigned int ii;
+
+    for (ii = 0; ii < SAMPLE_RING_SIZE; ii++) {
+        CHECK(sample_ring_push(&ring, ii));
+    }
+    CHECK(!sample_ring_push(&ring, 1000));
+    CHECK(!sample_ring_push(&ring, 1001));
+    CHECK(ring.dropped == 2);
+    CHECK(sample_ring_count(&ring) == SAMPLE_RING_SIZE);
+
+    for (ii = 0; ii < SAMPLE_RING_SIZE; ii++) {
+        CHECK(sample_ring_pop(&ring, &event));
+        CHECK(event.ticks == ii);
+    }
+    CHECK(event.edges == SAMPLE_RING_SIZE);
+    CHECK(ring.high_water == SAMPLE_RING_SIZE);
+
+    CHECK(sample_ring_push(&ring, 2000));
+    CHECK(sample_ring_pop(&ring, &event));
+    CHECK(event.ticks == 2000);
+    CHECK(event.edges == SAMPLE_RING_SIZE + 3);
+}
+
+/* The 16-bit edge count wraps, differences still hold. */
+static void test_edges_wrap(void)
+{
+    sample_ring_t ring = {0};
+    sample_event_t first, last;
+    uint16_t interrupts;
+
+    ring.edges = 0xFFFE;
+    CHECK(sample_ring_push(&ring, 1));
+    CHECK(sample_ring_push(&ring, 2));
+    CHECK(sample_ring_push(&ring, 3));
+    CHECK(sample_ring_pop(&ring, &first));
+    CHECK(sample_ring_pop(&ring, &last));
+    CHECK(sample_ring_pop(&ring, &last));
+    interrupts = last.edges - first.edges;
+    CHECK(interrupts == 2);
+}
+
+int main(void)
+{
+    test_order();
+    test_wrap();
+    test_full();
+    test_edges_wrap();
+    if (m_failures) {
+        printf("sample_ring: %d failures\n", m_failures);
+        return 1;
+    }
+    printf("sample_ring: ok\n");
+    return 0;
+}
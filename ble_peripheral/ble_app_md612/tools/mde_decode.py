@@ -0,0 +1,105 @@
+#!/usr/bin/python
+
+# mde_decode.py
+# Reference decoder for the MDE service motion notifications, see
+# MDE_FRAME_LEN in main.c and quat_codec.h.
+#
+# Reads one notification per line, as hex, from the files given or stdin and
+# prints one sample per line:
+#   seq timestamp_ms qw qx qy qz ax ay az
+# The quaternion is in Q14 (1.0 = 16384), the linear acceleration in mg.
+#
+#   mde_decode.py [--compressed] [file ...]
+
+from __future__ import print_function
+import binascii, fileinput, struct, sys
+
+FRAME_LEN = 20
+KEY_LEN = 19
+
+def decode_frames(payload):
+    """Samples of a notification in frame mode, one or more 20 byte frames."""
+    samples = []
+    for offset in range(0, len(payload) - FRAME_LEN + 1, FRAME_LEN):
+        fields = struct.unpack_from('<HI7h', payload, offset)
+        samples.append(fields)
+    return samples
+
+def isqrt(value):
+    root = 0
+    bit = 1 << 30
+    while bit > value:
+        bit >>= 2
+    while bit:
+        if value >= root + bit:
+            value -= root + bit
+            root = (root >> 1) + bit
+        else:
+            root >>= 1
+        bit >>= 2
+    return root
+
+def signed(value, bits):
+    if value & (1 << (bits - 1)):
+        value -= 1 << bits
+    return value
+
+def varint(payload, offset):
+    value = 0
+    shift = 0
+    while True:
+        byte = payload[offset]
+        offset += 1
+        value |= (byte & 0x7f) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, offset
+
+def unzigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+def decode_keyframe(payload, offset):
+    bits = 0
+    for ii in range(6):
+        bits |= payload[offset + ii] << (8 * ii)
+    largest = bits & 3
+    small = [signed((bits >> shift) & 0x7fff, 15) for shift in (2, 17, 32)]
+    total = sum(x * x for x in small)
+    quat = []
+    for ii in range(4):
+        if ii == largest:
+            quat.append(isqrt((1 << 28) - total) if total < (1 << 28) else 0)
+        else:
+            quat.append(small.pop(0))
+    return quat
+
+def decode_compressed(payload):
+    """Samples of a notification in compressed mode."""
+    seq, timestamp, count = struct.unpack_from('<HIB', payload, 0)
+    quat = decode_keyframe(payload, 7)
+    accel = list(struct.unpack_from('<3h', payload, 13))
+    samples = [tuple([seq, timestamp] + quat + accel)]
+    offset = KEY_LEN
+    for ii in range(1, count):
+        delta, offset = varint(payload, offset)
+        timestamp = (timestamp + delta) & 0xffffffff
+        for jj in range(4):
+            delta, offset = varint(payload, offset)
+            quat[jj] += unzigzag(delta)
+        for jj in range(3):
+            delta, offset = varint(payload, offset)
+            accel[jj] += unzigzag(delta)
+        samples.append(tuple([(seq + ii) & 0xffff, timestamp] + quat + accel))
+    return samples
+
+if __name__ == "__main__":
+    decode = decode_frames
+    if len(sys.argv) > 1 and sys.argv[1] == '--compressed':
+        decode = decode_compressed
+        del sys.argv[1]
+    for line in fileinput.input():
+        line = line.strip()
+        if not line:
+            continue
+        for sample in decode(bytearray(binascii.unhexlify(line))):
+            print(' '.join(str(x) for x in sample))
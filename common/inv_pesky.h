@@ -28,32 +28,49 @@ inline void get_ms(long unsigned int *timestamp)
     *timestamp = timestamp_func();
 }
 
+inline void get_us(uint64_t *timestamp)
+{
+    *timestamp = timestamp_us();
+}
+
 #define delay_ms nrf_delay_ms
 
 #define min(a,b) ((a<b)?a:b)
 
+/* Longest register write. The TWI peripheral sends a repeated START between
+ * chained transfers, so the register address and the payload have to go out
+ * as one transfer; and EasyDMA cannot read from flash, where the DMP image
+ * lives. The payload is therefore staged in a fixed RAM buffer instead of on
+ * the stack.
+ */
+#define I2C_WRITE_MAX_LENGTH    (128)
+
 static inline int i2c_write(unsigned char slave_addr, unsigned char reg_addr, unsigned char length, unsigned char const *data) {
-    unsigned char new_data[length + 1];
-    memcpy(new_data + 1, data, length);
-    new_data[0] = reg_addr;
+    static unsigned char tx_buf[I2C_WRITE_MAX_LENGTH + 1];
+
+    if (length > I2C_WRITE_MAX_LENGTH)
+        return -1;
+
+    tx_buf[0] = reg_addr;
+    memcpy(tx_buf + 1, data, length);
 
     app_twi_transfer_t const transfers[] = 
     {
-        APP_TWI_WRITE(slave_addr, new_data, length + 1, 0)
+        APP_TWI_WRITE(slave_addr, tx_buf, length + 1, 0)
     };
-    //log_i("w%d %d %d %d\n", slave_addr, reg_addr, length, new_data[1]);
-    //NRF_LOG_HEXDUMP_INFO(new_data, length + 1);
+    //log_i("w%d %d %d %d\n", slave_addr, reg_addr, length, tx_buf[1]);
+    //NRF_LOG_HEXDUMP_INFO(tx_buf, length + 1);
     //NRF_LOG_PROCESS();
 
-    ret_code_t err_code = app_twi_perform(&m_app_twi, transfers, sizeof(transfers) / sizeof(transfers[0]), NULL);
-    APP_ERROR_CHECK(err_code);
-    
+    if (app_twi_perform(&m_app_twi, transfers, sizeof(transfers) / sizeof(transfers[0]), NULL) != NRF_SUCCESS)
+        return -1;
+
     return 0;
 }
 
 static inline int i2c_read(unsigned char slave_addr, unsigned char reg_addr, unsigned char length, unsigned char *data) {
     if (length == 0)
-        return NRF_SUCCESS;
+        return 0;
 
     app_twi_transfer_t const transfers[] =
     {
@@ -61,8 +78,8 @@ static inline int i2c_read(unsigned char slave_addr, unsigned char reg_addr, uns
         APP_TWI_READ (slave_addr, data, length, 0)
     };
 
-    /*ret_code_t err_code = */app_twi_perform(&m_app_twi, transfers, sizeof(transfers) / sizeof(transfers[0]), NULL);
-    //APP_ERROR_CHECK(err_code);
+    if (app_twi_perform(&m_app_twi, transfers, sizeof(transfers) / sizeof(transfers[0]), NULL) != NRF_SUCCESS)
+        return -1;
 
     //log_i("r%d %d %d %d\n", slave_addr, reg_addr, length, data[0]);
     //NRF_LOG_HEXDUMP_INFO(data, length);
@@ -71,6 +88,62 @@ static inline int i2c_read(unsigned char slave_addr, unsigned char reg_addr, uns
     return 0;
 }
 
+/* Asynchronous transport built on app_twi_schedule. A request collects one or
+ * more register reads and runs them as a single TWI transaction; the callback
+ * is called from the TWI interrupt when the last transfer is done. The request
+ * and the data buffers must stay valid until then.
+ */
+#define I2C_ASYNC_MAX_READS     (6)
+
+typedef struct {
+    app_twi_transaction_t transaction;
+    app_twi_transfer_t    transfers[2 * I2C_ASYNC_MAX_READS];
+    unsigned char         reg_addr[I2C_ASYNC_MAX_READS];
+    unsigned char         reads;
+} i2c_async_t;
+
+static inline void i2c_async_init(i2c_async_t *p_req)
+{
+    p_req->reads = 0;
+}
+
+/* Reads longer than one TWI transfer are split into several segments of the
+ * same register, which is what the FIFO and memory ports expect.
+ */
+static inline int i2c_async_add_read(i2c_async_t *p_req, unsigned char slave_addr, unsigned char reg_addr, unsigned short length, unsigned char *data)
+{
+    while (length) {
+        unsigned char this_read = (length > 0xFF) ? 0xFF : length;
+
+        if (p_req->reads == I2C_ASYNC_MAX_READS)
+            return -1;
+
+        p_req->reg_addr[p_req->reads] = reg_addr;
+        p_req->transfers[2 * p_req->reads] = (app_twi_transfer_t)
+            APP_TWI_WRITE(slave_addr, &p_req->reg_addr[p_req->reads], 1, APP_TWI_NO_STOP);
+        p_req->transfers[2 * p_req->reads + 1] = (app_twi_transfer_t)
+            APP_TWI_READ(slave_addr, data, this_read, 0);
+        p_req->reads++;
+
+        data += this_read;
+        length -= this_read;
+    }
+    return 0;
+}
+
+static inline int i2c_async_schedule(i2c_async_t *p_req, app_twi_callback_t callback, void *p_context)
+{
+    if (!p_req->reads)
+        return -1;
+
+    p_req->transaction.callback            = callback;
+    p_req->transaction.p_user_data         = p_context;
+    p_req->transaction.p_transfers         = p_req->transfers;
+    p_req->transaction.number_of_transfers = 2 * p_req->reads;
+
+    return (app_twi_schedule(&m_app_twi, &p_req->transaction) == NRF_SUCCESS) ? 0 : -1;
+}
+
 static inline int reg_int_cb(struct int_param_s *int_param)
 {
     nrf_drv_gpiote_in_config_t config = GPIOTE_CONFIG_IN_SENSE_LOTOHI(true); // true - high accurracy
@@ -1,6 +1,8 @@
 #include "timestamping.h"
+#include "nrf.h"
 #include "nrf_drv_clock.h"
 #include "app_timer.h"
+#include "app_util_platform.h"
 
 void lfclk_config(void)
 {
@@ -12,20 +14,35 @@ void lfclk_config(void)
     nrf_drv_clock_lfclk_request(NULL);
 }
 
-uint32_t ticks_from = 0;
-uint32_t timestamp_ms = 0;
+static uint64_t m_ticks = 0;
+static uint32_t m_counter_last = 0;
 
-uint32_t timestamp_func(void) {
-    uint32_t ticks_diff = 0;
-    uint32_t ms_diff = 0;
-    uint32_t ticks_to = NRF_RTC0->COUNTER; //app_timer_cnt_get();
+/* The RTC counter is extended to 64 bits by accumulating the ticks since the
+ * last read, so the time base never wraps. Every conversion is done from the
+ * absolute count, so the sub-ms remainder is never thrown away and the clock
+ * doesn't drift no matter how often it is read.
+ */
+uint64_t timestamp_ticks(void)
+{
+    uint32_t counter;
+    uint64_t ticks;
 
-    APP_ERROR_CHECK(app_timer_cnt_diff_compute(ticks_to, ticks_from, &ticks_diff));
-    ticks_from = ticks_to;
+    CRITICAL_REGION_ENTER();
+    counter = TIMESTAMP_RTC->COUNTER;
+    m_ticks += (counter - m_counter_last) & TIMESTAMP_COUNTER_MASK;
+    m_counter_last = counter;
+    ticks = m_ticks;
+    CRITICAL_REGION_EXIT();
 
-    ms_diff = APP_TIMER_MS(ticks_diff, APP_TIMER_PRESCALER);
+    return ticks;
+}
 
-    timestamp_ms += ms_diff;
+uint64_t timestamp_us(void)
+{
+    return TIMESTAMP_TICKS_TO_US(timestamp_ticks());
+}
 
-    return timestamp_ms; 
-}
\ No newline at end of file
+uint32_t timestamp_func(void)
+{
+    return (uint32_t)TIMESTAMP_TICKS_TO_MS(timestamp_ticks());
+}
@@ -5,10 +5,33 @@
 
 #define APP_TIMER_PRESCALER             0                                           /**< Value of the RTC1 PRESCALER register. */
 #define APP_TIMER_OP_QUEUE_SIZE         4                                           /**< Size of timer operation queues. */
-#define APP_TIMER_MS(TICKS, PRESCALER)\
-            ((uint32_t)ROUNDED_DIV((TICKS) * ((PRESCALER) + 1) * 1000, (uint64_t)APP_TIMER_CLOCK_FREQ))
+
+/* RTC used as the time base, running at 32768 Hz (PRESCALER 0). Applications
+ * using app_timer should build with -DTIMESTAMP_RTC=NRF_RTC1 and keep a timer
+ * running, since app_timer clears RTC1 when its last timer stops.
+ */
+#ifndef TIMESTAMP_RTC
+#define TIMESTAMP_RTC                   NRF_RTC0
+#endif
+
+#define TIMESTAMP_TICK_FREQ             32768
+/* The RTC counter is 24 bits wide and wraps every 512 s. The time base must
+ * be read at least that often.
+ */
+#define TIMESTAMP_COUNTER_MASK          0x00FFFFFF
+#define TIMESTAMP_WRAP_MS               (((TIMESTAMP_COUNTER_MASK + 1ULL) * 1000) / TIMESTAMP_TICK_FREQ)
+
+/* Exact conversions of the absolute tick count, no remainder is lost. */
+#define TIMESTAMP_TICKS_TO_US(TICKS)    (((uint64_t)(TICKS) * 15625) >> 9)
+#define TIMESTAMP_TICKS_TO_MS(TICKS)    (((uint64_t)(TICKS) * 125) >> 12)
 
 void lfclk_config(void);
+
+/* Monotonic 64-bit time base. Safe to call from any context. */
+uint64_t timestamp_ticks(void);
+uint64_t timestamp_us(void);
+
+/* Milliseconds, wraps every 49.7 days. Used by NRF_LOG and the MPL. */
 uint32_t timestamp_func(void);
 
-#endif // _TIMESTAMPING_
\ No newline at end of file
+#endif // _TIMESTAMPING_
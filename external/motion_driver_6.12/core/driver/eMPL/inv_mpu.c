@@ -286,6 +286,8 @@ struct chip_cfg_s {
     unsigned short compass_sample_rate;
     unsigned char compass_addr;
     short mag_sens_adj[3];
+    /* 1 if compass data is read along with the FIFO. */
+    unsigned char compass_fifo;
 #endif
 };
 
@@ -621,6 +623,12 @@ static struct gyro_state_s st = {
 #endif
 
 #define MAX_PACKET_LENGTH (12)
+/* Longest single I2C read supported by the platform layer (8-bit length). */
+#define MAX_I2C_READ_LENGTH (255)
+/* Longest packet the FIFO can be realigned for, a DMP packet with every
+ * feature enabled.
+ */
+#define MAX_FIFO_PACKET_LENGTH (32)
 #ifdef MPU6500
 #define HWST_MAX_PACKET_LENGTH (512)
 #endif
@@ -629,6 +637,172 @@ static struct gyro_state_s st = {
 static int setup_compass(void);
 #define MAX_COMPASS_SAMPLE_RATE (100)
 #endif
+#if defined AK89xx_SECONDARY && !defined AK89xx_BYPASS
+static int compass_fifo_store(const unsigned char *raw);
+/* ST1..ST2 registers read by slave 0. */
+#define COMPASS_FIFO_LENGTH (8)
+#endif
+
+/* Register shadow.
+ * The configuration registers are only changed by this driver, so the last
+ * value written to each one is kept in RAM. Writes that would not change
+ * anything are skipped, multi-byte writes only send the span that changed,
+ * and read-modify-write sequences read from RAM instead of the bus.
+ * Data, status, FIFO and DMP memory registers are never shadowed.
+ */
+#define SHADOW_REGS         (128)
+/* Bits that trigger an action and clear themselves. */
+#define USER_CTRL_RST_BITS  (0x0F)
+
+static struct {
+    unsigned char value[SHADOW_REGS];
+    unsigned char cacheable[SHADOW_REGS / 8];
+    unsigned char valid[SHADOW_REGS / 8];
+    unsigned long hits;
+    unsigned long misses;
+} shadow;
+
+#define SHADOW_BIT(map, reg)    ((map)[(reg) >> 3] & (1 << ((reg) & 7)))
+
+static void shadow_add(unsigned char reg)
+{
+    shadow.cacheable[reg >> 3] |= 1 << (reg & 7);
+}
+
+static void shadow_init(void)
+{
+    memset(&shadow, 0, sizeof(shadow));
+    shadow_add(st.reg->rate_div);
+    shadow_add(st.reg->lpf);
+    shadow_add(st.reg->gyro_cfg);
+    shadow_add(st.reg->accel_cfg);
+    shadow_add(st.reg->motion_thr);
+    shadow_add(st.reg->fifo_en);
+    shadow_add(st.reg->i2c_mst);
+    shadow_add(st.reg->int_pin_cfg);
+    shadow_add(st.reg->int_enable);
+    shadow_add(st.reg->user_ctrl);
+    shadow_add(st.reg->pwr_mgmt_1);
+    shadow_add(st.reg->pwr_mgmt_2);
+#ifdef MPU6500
+    shadow_add(st.reg->accel_cfg2);
+    shadow_add(st.reg->lp_accel_odr);
+    shadow_add(st.reg->accel_intel);
+#endif
+#ifdef AK89xx_SECONDARY
+    shadow_add(st.reg->s0_addr);
+    shadow_add(st.reg->s0_reg);
+    shadow_add(st.reg->s0_ctrl);
+    shadow_add(st.reg->s1_addr);
+    shadow_add(st.reg->s1_reg);
+    shadow_add(st.reg->s1_ctrl);
+    shadow_add(st.reg->s4_ctrl);
+    shadow_add(st.reg->s1_do);
+    shadow_add(st.reg->i2c_delay_ctrl);
+#endif
+}
+
+static unsigned char shadow_rst_bits(unsigned char reg)
+{
+    if (reg == st.reg->user_ctrl)
+        return USER_CTRL_RST_BITS;
+    if (reg == st.reg->pwr_mgmt_1)
+        return BIT_RESET;
+    return 0;
+}
+
+static void shadow_store(unsigned char reg, unsigned char value)
+{
+    if (!SHADOW_BIT(shadow.cacheable, reg))
+        return;
+    if ((reg == st.reg->pwr_mgmt_1) && (value & BIT_RESET)) {
+        /* Device reset, every register is back to its default. */
+        memset(shadow.valid, 0, sizeof(shadow.valid));
+        return;
+    }
+    shadow.value[reg] = value & ~shadow_rst_bits(reg);
+    shadow.valid[reg >> 3] |= 1 << (reg & 7);
+}
+
+/**
+ *  @brief      Write registers through the shadow.
+ *  @param[in]  reg     First register.
+ *  @param[in]  length  Number of registers.
+ *  @param[in]  data    New values.
+ *  @return     0 if successful.
+ */
+static int reg_write(unsigned char reg, unsigned char length,
+    unsigned char const *data)
+{
+    unsigned char ii, first = length, last = 0, cached = 1;
+
+    if (!length || (reg + length > SHADOW_REGS))
+        return i2c_write(st.hw->addr, reg, length, data);
+
+    for (ii = 0; ii < length; ii++) {
+        unsigned char r = reg + ii;
+        if (!SHADOW_BIT(shadow.cacheable, r)) {
+            cached = 0;
+            break;
+        }
+        if (!SHADOW_BIT(shadow.valid, r) || (shadow.value[r] != data[ii]) ||
+            (data[ii] & shadow_rst_bits(r))) {
+            if (first == length)
+                first = ii;
+            last = ii;
+        }
+    }
+
+    if (!cached) {
+        if (i2c_write(st.hw->addr, reg, length, data))
+            return -1;
+    } else if (first == length) {
+        shadow.hits++;
+        return 0;
+    } else {
+        shadow.misses++;
+        if (i2c_write(st.hw->addr, reg + first, last - first + 1,
+                data + first))
+            return -1;
+    }
+
+    for (ii = 0; ii < length; ii++)
+        shadow_store(reg + ii, data[ii]);
+    return 0;
+}
+
+/**
+ *  @brief      Read registers through the shadow.
+ *  Served from RAM if every register is shadowed and known.
+ *  @param[in]  reg     First register.
+ *  @param[in]  length  Number of registers.
+ *  @param[out] data    Register values.
+ *  @return     0 if successful.
+ */
+static int reg_read(unsigned char reg, unsigned char length,
+    unsigned char *data)
+{
+    unsigned char ii;
+
+    for (ii = 0; ii < length; ii++) {
+        unsigned char r = reg + ii;
+        if ((r >= SHADOW_REGS) || !SHADOW_BIT(shadow.valid, r))
+            break;
+    }
+    if (length && (ii == length)) {
+        memcpy(data, &shadow.value[reg], length);
+        shadow.hits++;
+        return 0;
+    }
+
+    shadow.misses++;
+    if (i2c_read(st.hw->addr, reg, length, data))
+        return -1;
+    for (ii = 0; ii < length; ii++)
+        if (reg + ii < SHADOW_REGS)
+            shadow_store(reg + ii, data[ii]);
+    return 0;
+}
 
 /**
  *  @brief      Enable/disable data ready interrupt.
@@ -646,7 +820,7 @@ static int set_int_enable(unsigned char enable)
             tmp = BIT_DMP_INT_EN;
         else
             tmp = 0x00;
-        if (i2c_write(st.hw->addr, st.reg->int_enable, 1, &tmp))
+        if (reg_write(st.reg->int_enable, 1, &tmp))
             return -1;
         st.chip_cfg.int_enable = tmp;
     } else {
@@ -658,7 +832,7 @@ static int set_int_enable(unsigned char enable)
             tmp = BIT_DATA_RDY_EN;
         else
             tmp = 0x00;
-        if (i2c_write(st.hw->addr, st.reg->int_enable, 1, &tmp))
+        if (reg_write(st.reg->int_enable, 1, &tmp))
             return -1;
         st.chip_cfg.int_enable = tmp;
     }
@@ -684,6 +858,66 @@ int mpu_reg_dump(void)
     return 0;
 }
 
+/**
+ *  @brief      Get the register shadow statistics.
+ *  A hit is a write that was skipped or a read served from RAM; a miss went
+ *  out on the bus.
+ *  @param[out] hits    Number of bus transactions saved.
+ *  @param[out] misses  Number of shadowed accesses that needed the bus.
+ *  @return     0 if successful.
+ */
+int mpu_get_shadow_stats(unsigned long *hits, unsigned long *misses)
+{
+    hits[0] = shadow.hits;
+    misses[0] = shadow.misses;
+    return 0;
+}
+
+/* FIFO loss accounting. */
+static struct {
+    unsigned long overflows;
+    unsigned long resets;
+} fifo_stats;
+
+/**
+ *  @brief      Get the FIFO loss statistics.
+ *  @param[out] overflows   Number of FIFO overflows seen since power-up.
+ *  @param[out] resets      Number of FIFO resets, including the ones done
+ *                          while configuring the device.
+ *  @return     0 if successful.
+ */
+int mpu_get_fifo_stats(unsigned long *overflows, unsigned long *resets)
+{
+    overflows[0] = fifo_stats.overflows;
+    resets[0] = fifo_stats.resets;
+    return 0;
+}
+
+/**
+ *  @brief      Realign the FIFO after an overflow.
+ *  When the FIFO is full, new data overwrites the oldest bytes, so the read
+ *  pointer is no longer on a packet boundary. Packets are always written
+ *  whole, so the partial packet is the first @e count % @e length bytes;
+ *  they are read out and discarded. The packets left are valid.
+ *  @param[in]      length  Length of one FIFO packet.
+ *  @param[in,out]  count   Number of bytes in the FIFO.
+ *  @return     0 if successful.
+ */
+static int fifo_realign(unsigned short length, unsigned short *count)
+{
+    unsigned char tmp[MAX_FIFO_PACKET_LENGTH];
+    unsigned short skip;
+
+    fifo_stats.overflows++;
+    if (!length || (length > MAX_FIFO_PACKET_LENGTH))
+        return -1;
+    skip = count[0] % length;
+    if (skip && i2c_read(st.hw->addr, st.reg->fifo_r_w, skip, tmp))
+        return -1;
+    count[0] -= skip;
+    return 0;
+}
+
 /**
  *  @brief      Read from a single register.
  *  NOTE: The memory and FIFO read/write registers cannot be accessed.
@@ -717,15 +951,17 @@ int mpu_init(struct int_param_s *int_param)
 {
     unsigned char data[6];
 
+    shadow_init();
+
     /* Reset device. */
     data[0] = BIT_RESET;
-    if (i2c_write(st.hw->addr, st.reg->pwr_mgmt_1, 1, data))
+    if (reg_write(st.reg->pwr_mgmt_1, 1, data))
         return -1;
     delay_ms(100);
 
     /* Wake up chip. */
     data[0] = 0x00;
-    if (i2c_write(st.hw->addr, st.reg->pwr_mgmt_1, 1, data))
+    if (reg_write(st.reg->pwr_mgmt_1, 1, data))
         return -1;
 
    st.chip_cfg.accel_half = 0;
@@ -735,7 +971,7 @@ int mpu_init(struct int_param_s *int_param)
      * first 3kB are needed by the DMP, we'll use the last 1kB for the FIFO.
      */
     data[0] = BIT_FIFO_SIZE_1024 | 0x8;
-    if (i2c_write(st.hw->addr, st.reg->accel_cfg2, 1, data))
+    if (reg_write(st.reg->accel_cfg2, 1, data))
         return -1;
 #endif
 
@@ -818,7 +1054,7 @@ int mpu_lp_accel_mode(unsigned short rate)
         mpu_set_int_latched(0);
         tmp[0] = 0;
         tmp[1] = BIT_STBY_XYZG;
-        if (i2c_write(st.hw->addr, st.reg->pwr_mgmt_1, 2, tmp))
+        if (reg_write(st.reg->pwr_mgmt_1, 2, tmp))
             return -1;
         st.chip_cfg.lp_accel_mode = 0;
         return 0;
@@ -847,7 +1083,7 @@ int mpu_lp_accel_mode(unsigned short rate)
         mpu_set_lpf(20);
     }
     tmp[1] = (tmp[1] << 6) | BIT_STBY_XYZG;
-    if (i2c_write(st.hw->addr, st.reg->pwr_mgmt_1, 2, tmp))
+    if (reg_write(st.reg->pwr_mgmt_1, 2, tmp))
         return -1;
 #elif defined MPU6500
     /* Set wake frequency. */
@@ -871,10 +1107,10 @@ int mpu_lp_accel_mode(unsigned short rate)
         tmp[0] = INV_LPA_320HZ;
     else
         tmp[0] = INV_LPA_640HZ;
-    if (i2c_write(st.hw->addr, st.reg->lp_accel_odr, 1, tmp))
+    if (reg_write(st.reg->lp_accel_odr, 1, tmp))
         return -1;
     tmp[0] = BIT_LPA_CYCLE;
-    if (i2c_write(st.hw->addr, st.reg->pwr_mgmt_1, 1, tmp))
+    if (reg_write(st.reg->pwr_mgmt_1, 1, tmp))
         return -1;
 #endif
     st.chip_cfg.sensors = INV_XYZ_ACCEL;
@@ -931,6 +1167,12 @@ int mpu_get_accel_reg(short *data, unsigned long *timestamp)
     return 0;
 }
 
+/* Convert a TEMP_OUT reading to degrees C in q16 format. */
+static long temp_to_q16(short raw)
+{
+    return (long)((35 + ((raw - (float)st.hw->temp_offset) / st.hw->temp_sens)) * 65536L);
+}
+
 /**
  *  @brief      Read temperature data directly from the registers.
  *  @param[out] data        Data in q16 format.
@@ -951,7 +1193,7 @@ int mpu_get_temperature(long *data, unsigned long *timestamp)
     if (timestamp)
         get_ms(timestamp);
 
-    data[0] = (long)((35 + ((raw - (float)st.hw->temp_offset) / st.hw->temp_sens)) * 65536L);
+    data[0] = temp_to_q16(raw);
     return 0;
 }
 
@@ -1034,11 +1276,11 @@ int mpu_set_gyro_bias_reg(long *gyro_bias)
     data[3] = (gyro_bias[1]) & 0xff;
     data[4] = (gyro_bias[2] >> 8) & 0xff;
     data[5] = (gyro_bias[2]) & 0xff;
-    if (i2c_write(st.hw->addr, 0x13, 2, &data[0]))
+    if (reg_write(0x13, 2, &data[0]))
         return -1;
-    if (i2c_write(st.hw->addr, 0x15, 2, &data[2]))
+    if (reg_write(0x15, 2, &data[2]))
         return -1;
-    if (i2c_write(st.hw->addr, 0x17, 2, &data[4]))
+    if (reg_write(0x17, 2, &data[4]))
         return -1;
     return 0;
 }
@@ -1069,11 +1311,11 @@ int mpu_set_accel_bias_6050_reg(const long *accel_bias) {
     data[4] = (accel_reg_bias[2] >> 8) & 0xff;
     data[5] = (accel_reg_bias[2]) & 0xff;
 
-    if (i2c_write(st.hw->addr, 0x06, 2, &data[0]))
+    if (reg_write(0x06, 2, &data[0]))
         return -1;
-    if (i2c_write(st.hw->addr, 0x08, 2, &data[2]))
+    if (reg_write(0x08, 2, &data[2]))
         return -1;
-    if (i2c_write(st.hw->addr, 0x0A, 2, &data[4]))
+    if (reg_write(0x0A, 2, &data[4]))
         return -1;
 
     return 0;
@@ -1108,11 +1350,11 @@ int mpu_set_accel_bias_6500_reg(const long *accel_bias) {
     data[4] = (accel_reg_bias[2] >> 8) & 0xff;
     data[5] = (accel_reg_bias[2]) & 0xff;
 
-    if (i2c_write(st.hw->addr, 0x77, 2, &data[0]))
+    if (reg_write(0x77, 2, &data[0]))
         return -1;
-    if (i2c_write(st.hw->addr, 0x7A, 2, &data[2]))
+    if (reg_write(0x7A, 2, &data[2]))
         return -1;
-    if (i2c_write(st.hw->addr, 0x7D, 2, &data[4]))
+    if (reg_write(0x7D, 2, &data[4]))
         return -1;
 
     return 0;
@@ -1130,51 +1372,52 @@ int mpu_reset_fifo(void)
     if (!(st.chip_cfg.sensors))
         return -1;
 
+    fifo_stats.resets++;
     data = 0;
-    if (i2c_write(st.hw->addr, st.reg->int_enable, 1, &data))
+    if (reg_write(st.reg->int_enable, 1, &data))
         return -1;
-    if (i2c_write(st.hw->addr, st.reg->fifo_en, 1, &data))
+    if (reg_write(st.reg->fifo_en, 1, &data))
         return -1;
-    if (i2c_write(st.hw->addr, st.reg->user_ctrl, 1, &data))
+    if (reg_write(st.reg->user_ctrl, 1, &data))
         return -1;
 
     if (st.chip_cfg.dmp_on) {
         data = BIT_FIFO_RST | BIT_DMP_RST;
-        if (i2c_write(st.hw->addr, st.reg->user_ctrl, 1, &data))
+        if (reg_write(st.reg->user_ctrl, 1, &data))
             return -1;
         delay_ms(50);
         data = BIT_DMP_EN | BIT_FIFO_EN;
         if (st.chip_cfg.sensors & INV_XYZ_COMPASS)
             data |= BIT_AUX_IF_EN;
-        if (i2c_write(st.hw->addr, st.reg->user_ctrl, 1, &data))
+        if (reg_write(st.reg->user_ctrl, 1, &data))
             return -1;
         if (st.chip_cfg.int_enable)
             data = BIT_DMP_INT_EN;
         else
             data = 0;
-        if (i2c_write(st.hw->addr, st.reg->int_enable, 1, &data))
+        if (reg_write(st.reg->int_enable, 1, &data))
             return -1;
         data = 0;
-        if (i2c_write(st.hw->addr, st.reg->fifo_en, 1, &data))
+        if (reg_write(st.reg->fifo_en, 1, &data))
             return -1;
     } else {
         data = BIT_FIFO_RST;
-        if (i2c_write(st.hw->addr, st.reg->user_ctrl, 1, &data))
+        if (reg_write(st.reg->user_ctrl, 1, &data))
             return -1;
         if (st.chip_cfg.bypass_mode || !(st.chip_cfg.sensors & INV_XYZ_COMPASS))
             data = BIT_FIFO_EN;
         else
             data = BIT_FIFO_EN | BIT_AUX_IF_EN;
-        if (i2c_write(st.hw->addr, st.reg->user_ctrl, 1, &data))
+        if (reg_write(st.reg->user_ctrl, 1, &data))
             return -1;
         delay_ms(50);
         if (st.chip_cfg.int_enable)
             data = BIT_DATA_RDY_EN;
         else
             data = 0;
-        if (i2c_write(st.hw->addr, st.reg->int_enable, 1, &data))
+        if (reg_write(st.reg->int_enable, 1, &data))
             return -1;
-        if (i2c_write(st.hw->addr, st.reg->fifo_en, 1, &st.chip_cfg.fifo_enable))
+        if (reg_write(st.reg->fifo_en, 1, &st.chip_cfg.fifo_enable))
             return -1;
     }
     return 0;
@@ -1238,7 +1481,7 @@ int mpu_set_gyro_fsr(unsigned short fsr)
 
     if (st.chip_cfg.gyro_fsr == (data >> 3))
         return 0;
-    if (i2c_write(st.hw->addr, st.reg->gyro_cfg, 1, &data))
+    if (reg_write(st.reg->gyro_cfg, 1, &data))
         return -1;
     st.chip_cfg.gyro_fsr = data >> 3;
     return 0;
@@ -1303,7 +1546,7 @@ int mpu_set_accel_fsr(unsigned char fsr)
 
     if (st.chip_cfg.accel_fsr == (data >> 3))
         return 0;
-    if (i2c_write(st.hw->addr, st.reg->accel_cfg, 1, &data))
+    if (reg_write(st.reg->accel_cfg, 1, &data))
         return -1;
     st.chip_cfg.accel_fsr = data >> 3;
     return 0;
@@ -1372,7 +1615,7 @@ int mpu_set_lpf(unsigned short lpf)
 
     if (st.chip_cfg.lpf == data)
         return 0;
-    if (i2c_write(st.hw->addr, st.reg->lpf, 1, &data))
+    if (reg_write(st.reg->lpf, 1, &data))
         return -1;
     st.chip_cfg.lpf = data;
     return 0;
@@ -1425,7 +1668,7 @@ int mpu_set_sample_rate(unsigned short rate)
             rate = 1000;
 
         data = 1000 / rate - 1;
-        if (i2c_write(st.hw->addr, st.reg->rate_div, 1, &data))
+        if (reg_write(st.reg->rate_div, 1, &data))
             return -1;
 
         st.chip_cfg.sample_rate = 1000 / (1 + data);
@@ -1475,7 +1718,7 @@ int mpu_set_compass_sample_rate(unsigned short rate)
         return -1;
 
     div = st.chip_cfg.sample_rate / rate - 1;
-    if (i2c_write(st.hw->addr, st.reg->s4_ctrl, 1, &div))
+    if (reg_write(st.reg->s4_ctrl, 1, &div))
         return -1;
     st.chip_cfg.compass_sample_rate = st.chip_cfg.sample_rate / (div + 1);
     return 0;
@@ -1567,8 +1810,18 @@ int mpu_configure_fifo(unsigned char sensors)
     unsigned char prev;
     int result = 0;
 
+#if defined AK89xx_SECONDARY && !defined AK89xx_BYPASS
+    /* Compass data only goes into the FIFO if requested with
+     * mpu_set_compass_fifo, and then along with the other sensors.
+     */
+    if (st.chip_cfg.compass_fifo && sensors)
+        sensors |= st.chip_cfg.sensors & INV_XYZ_COMPASS;
+    else
+        sensors &= ~INV_XYZ_COMPASS;
+#else
     /* Compass data isn't going into the FIFO. Stop trying. */
     sensors &= ~INV_XYZ_COMPASS;
+#endif
 
     if (st.chip_cfg.dmp_on)
         return 0;
@@ -1625,36 +1878,34 @@ int mpu_get_power_state(unsigned char *power_on)
  */
 int mpu_set_sensors(unsigned char sensors)
 {
-    unsigned char data;
+    unsigned char data, pwr_mgmt[2];
 #ifdef AK89xx_SECONDARY
     unsigned char user_ctrl;
 #endif
 
     if (sensors & INV_XYZ_GYRO)
-        data = INV_CLK_PLL;
+        pwr_mgmt[0] = INV_CLK_PLL;
     else if (sensors)
-        data = 0;
+        pwr_mgmt[0] = 0;
     else
-        data = BIT_SLEEP;
-    if (i2c_write(st.hw->addr, st.reg->pwr_mgmt_1, 1, &data)) {
-        st.chip_cfg.sensors = 0;
-        return -1;
-    }
-    st.chip_cfg.clk_src = data & ~BIT_SLEEP;
+        pwr_mgmt[0] = BIT_SLEEP;
 
-    data = 0;
+    pwr_mgmt[1] = 0;
     if (!(sensors & INV_X_GYRO))
-        data |= BIT_STBY_XG;
+        pwr_mgmt[1] |= BIT_STBY_XG;
     if (!(sensors & INV_Y_GYRO))
-        data |= BIT_STBY_YG;
+        pwr_mgmt[1] |= BIT_STBY_YG;
     if (!(sensors & INV_Z_GYRO))
-        data |= BIT_STBY_ZG;
+        pwr_mgmt[1] |= BIT_STBY_ZG;
     if (!(sensors & INV_XYZ_ACCEL))
-        data |= BIT_STBY_XYZA;
-    if (i2c_write(st.hw->addr, st.reg->pwr_mgmt_2, 1, &data)) {
+        pwr_mgmt[1] |= BIT_STBY_XYZA;
+
+    /* PWR_MGMT_1 and PWR_MGMT_2 are adjacent, update them in one burst. */
+    if (reg_write(st.reg->pwr_mgmt_1, 2, pwr_mgmt)) {
         st.chip_cfg.sensors = 0;
         return -1;
     }
+    st.chip_cfg.clk_src = pwr_mgmt[0] & ~BIT_SLEEP;
 
     if (sensors && (sensors != INV_XYZ_ACCEL))
         /* Latched interrupts only used in LP accel mode. */
@@ -1667,7 +1918,7 @@ int mpu_set_sensors(unsigned char sensors)
     else
         mpu_set_bypass(0);
 #else
-    if (i2c_read(st.hw->addr, st.reg->user_ctrl, 1, &user_ctrl))
+    if (reg_read(st.reg->user_ctrl, 1, &user_ctrl))
         return -1;
     /* Handle AKM power management. */
     if (sensors & INV_XYZ_COMPASS) {
@@ -1681,10 +1932,10 @@ int mpu_set_sensors(unsigned char sensors)
         user_ctrl |= BIT_DMP_EN;
     else
         user_ctrl &= ~BIT_DMP_EN;
-    if (i2c_write(st.hw->addr, st.reg->s1_do, 1, &data))
+    if (reg_write(st.reg->s1_do, 1, &data))
         return -1;
     /* Enable/disable I2C master mode. */
-    if (i2c_write(st.hw->addr, st.reg->user_ctrl, 1, &user_ctrl))
+    if (reg_write(st.reg->user_ctrl, 1, &user_ctrl))
         return -1;
 #endif
 #endif
@@ -1722,6 +1973,10 @@ int mpu_get_int_status(short *status)
  *  \n If the FIFO has no new data, @e sensors will be zero.
  *  \n If the FIFO is disabled, @e sensors will be zero and this function will
  *  return a non-zero error code.
+ *  \n If the FIFO has overflowed, it is realigned instead of reset; the
+ *  overflow is counted in @e mpu_get_fifo_stats.
+ *  \n If the compass is read through the FIFO (see @e mpu_set_compass_fifo),
+ *  INV_XYZ_COMPASS is set when the packet holds a new compass sample.
  *  @param[out] gyro        Gyro data in hardware units.
  *  @param[out] accel       Accel data in hardware units.
  *  @param[out] timestamp   Timestamp in milliseconds.
@@ -1732,8 +1987,14 @@ int mpu_get_int_status(short *status)
 int mpu_read_fifo(short *gyro, short *accel, unsigned long *timestamp,
         unsigned char *sensors, unsigned char *more)
 {
-    /* Assumes maximum packet size is gyro (6) + accel (6). */
+    /* Assumes maximum packet size is gyro (6) + accel (6), plus the compass
+     * registers if they go into the FIFO.
+     */
+#if defined AK89xx_SECONDARY && !defined AK89xx_BYPASS
+    unsigned char data[MAX_PACKET_LENGTH + COMPASS_FIFO_LENGTH];
+#else
     unsigned char data[MAX_PACKET_LENGTH];
+#endif
     unsigned char packet_size = 0;
     unsigned short fifo_count, index = 0;
 
@@ -1754,6 +2015,10 @@ int mpu_read_fifo(short *gyro, short *accel, unsigned long *timestamp,
         packet_size += 2;
     if (st.chip_cfg.fifo_enable & INV_XYZ_ACCEL)
         packet_size += 6;
+#if defined AK89xx_SECONDARY && !defined AK89xx_BYPASS
+    if (st.chip_cfg.fifo_enable & INV_XYZ_COMPASS)
+        packet_size += COMPASS_FIFO_LENGTH;
+#endif
 
     if (i2c_read(st.hw->addr, st.reg->fifo_count_h, 2, data))
         return -1;
@@ -1766,8 +2031,11 @@ int mpu_read_fifo(short *gyro, short *accel, unsigned long *timestamp,
         if (i2c_read(st.hw->addr, st.reg->int_status, 1, data))
             return -1;
         if (data[0] & BIT_FIFO_OVERFLOW) {
-            mpu_reset_fifo();
-            return -2;
+            /* Keep what is left instead of resetting the FIFO. */
+            if (fifo_realign(packet_size, &fifo_count))
+                return -1;
+            if (fifo_count < packet_size)
+                return 0;
         }
     }
     get_ms((unsigned long*)timestamp);
@@ -1799,6 +2067,14 @@ int mpu_read_fifo(short *gyro, short *accel, unsigned long *timestamp,
         sensors[0] |= INV_Z_GYRO;
         index += 2;
     }
+#if defined AK89xx_SECONDARY && !defined AK89xx_BYPASS
+    /* External sensor data comes last. Fetch it with mpu_get_compass_fifo. */
+    if ((index != packet_size) && st.chip_cfg.fifo_enable & INV_XYZ_COMPASS) {
+        if (!compass_fifo_store(data + index))
+            sensors[0] |= INV_XYZ_COMPASS;
+        index += COMPASS_FIFO_LENGTH;
+    }
+#endif
 
     return 0;
 }
@@ -1806,6 +2082,8 @@ int mpu_read_fifo(short *gyro, short *accel, unsigned long *timestamp,
 /**
  *  @brief      Get one unparsed packet from the FIFO.
  *  This function should be used if the packet is to be parsed elsewhere.
+ *  \n If the FIFO has overflowed, it is realigned instead of reset; the
+ *  overflow is counted in @e mpu_get_fifo_stats.
  *  @param[in]  length  Length of one FIFO packet.
  *  @param[in]  data    FIFO packet.
  *  @param[in]  more    Number of remaining packets.
@@ -1832,8 +2110,13 @@ int mpu_read_fifo_stream(unsigned short length, unsigned char *data,
         if (i2c_read(st.hw->addr, st.reg->int_status, 1, tmp))
             return -1;
         if (tmp[0] & BIT_FIFO_OVERFLOW) {
-            mpu_reset_fifo();
-            return -2;
+            /* Keep what is left instead of resetting the FIFO. */
+            if (fifo_realign(length, &fifo_count))
+                return -1;
+            if (fifo_count < length) {
+                more[0] = 0;
+                return -1;
+            }
         }
     }
 
@@ -1843,6 +2126,275 @@ int mpu_read_fifo_stream(unsigned short length, unsigned char *data,
     return 0;
 }
 
+/**
+ *  @brief      Get the number of bytes in the FIFO.
+ *  Used with @e mpu_read_fifo_packets to drain several packets with a single
+ *  FIFO_COUNT read.
+ *  \n If the FIFO has overflowed, the partial packet at its head is discarded
+ *  and -2 is returned. @e count is still valid, but packets were lost before
+ *  the ones left in the FIFO.
+ *  @param[in]  length  Length of one FIFO packet.
+ *  @param[out] count   Number of bytes in the FIFO.
+ *  @return     0 if successful, -2 if the FIFO overflowed.
+ */
+int mpu_get_fifo_count(unsigned short length, unsigned short *count)
+{
+    unsigned char tmp[2];
+
+    count[0] = 0;
+    if (!st.chip_cfg.sensors)
+        return -1;
+
+    if (i2c_read(st.hw->addr, st.reg->fifo_count_h, 2, tmp))
+        return -1;
+    count[0] = (tmp[0] << 8) | tmp[1];
+    if (count[0] > (st.hw->max_fifo >> 1)) {
+        /* FIFO is 50% full, better check overflow bit. */
+        if (i2c_read(st.hw->addr, st.reg->int_status, 1, tmp))
+            return -1;
+        if (tmp[0] & BIT_FIFO_OVERFLOW) {
+            if (fifo_realign(length, count)) {
+                count[0] = 0;
+                return -1;
+            }
+            return -2;
+        }
+    }
+    return 0;
+}
+
+/**
+ *  @brief      Get the size of the FIFO.
+ *  @param[out] size    FIFO size in bytes.
+ *  @return     0 if successful.
+ */
+int mpu_get_fifo_size(unsigned short *size)
+{
+    size[0] = st.hw->max_fifo;
+    return 0;
+}
+
+/**
+ *  @brief      Burst read unparsed packets from the FIFO.
+ *  The caller is responsible for making sure the FIFO holds at least
+ *  @e length * @e packets bytes (see @e mpu_get_fifo_count). The read is split
+ *  into as few I2C transfers as the bus driver allows, each one a whole number
+ *  of packets.
+ *  @param[in]  length  Length of one FIFO packet.
+ *  @param[in]  packets Number of packets to read.
+ *  @param[out] data    FIFO packets, @e length * @e packets bytes.
+ *  @return     0 if successful.
+ */
+int mpu_read_fifo_packets(unsigned short length, unsigned short packets,
+    unsigned char *data)
+{
+    unsigned short per_read, this_read;
+
+    if (!length || (length > MAX_I2C_READ_LENGTH))
+        return -1;
+
+    per_read = MAX_I2C_READ_LENGTH / length;
+    while (packets) {
+        this_read = min(packets, per_read);
+        if (i2c_read(st.hw->addr, st.reg->fifo_r_w, this_read * length, data))
+            return -1;
+        data += this_read * length;
+        packets -= this_read;
+    }
+    return 0;
+}
+
+#if defined NRF52
+/* INT_STATUS, ACCEL_OUT and TEMP_OUT are contiguous, so the temperature is
+ * read in the same burst as the overflow bit.
+ */
+#define INT_STATUS_TO_TEMP_LENGTH (9)
+
+/* Last TEMP_OUT value read along with the FIFO count. */
+static struct {
+    short raw;
+    volatile unsigned char fresh;
+} fifo_temp;
+
+static struct {
+    i2c_async_t count_req;
+    i2c_async_t data_req;
+    /* FIFO_COUNT, then INT_STATUS..TEMP_OUT. */
+    unsigned char status[2 + INT_STATUS_TO_TEMP_LENGTH];
+#if defined AK89xx_SECONDARY && !defined AK89xx_BYPASS
+    unsigned char compass[COMPASS_FIFO_LENGTH];
+    unsigned char read_compass;
+#endif
+    unsigned char skip[MAX_FIFO_PACKET_LENGTH];
+    unsigned char overflow;
+    unsigned short length;
+    unsigned short max_packets;
+    unsigned short packets;
+    unsigned short more;
+    unsigned char *data;
+    mpu_fifo_cb_t cb;
+    volatile unsigned char busy;
+    /* RTC time FIFO_COUNT was read. */
+    uint64_t count_ticks;
+} fifo_async;
+
+static void fifo_async_done(int result)
+{
+    fifo_async.busy = 0;
+    if (result == -1)
+        fifo_async.packets = 0;
+    fifo_async.cb(result, fifo_async.packets, fifo_async.more);
+}
+
+static void fifo_async_data_cb(ret_code_t result, void *p_context)
+{
+    if (result != NRF_SUCCESS)
+        fifo_async_done(-1);
+    else
+        fifo_async_done(fifo_async.overflow ? -2 : 0);
+}
+
+static void fifo_async_count_cb(ret_code_t result, void *p_context)
+{
+    unsigned short fifo_count, skip = 0;
+
+    fifo_async.count_ticks = timestamp_ticks();
+    if (result != NRF_SUCCESS) {
+        fifo_async_done(-1);
+        return;
+    }
+#if defined AK89xx_SECONDARY && !defined AK89xx_BYPASS
+    if (fifo_async.read_compass)
+        compass_fifo_store(fifo_async.compass);
+#endif
+    /* TEMP_OUT is the last two bytes of the burst. */
+    fifo_temp.raw = (fifo_async.status[sizeof(fifo_async.status) - 2] << 8) |
+        fifo_async.status[sizeof(fifo_async.status) - 1];
+    fifo_temp.fresh = 1;
+    fifo_count = (fifo_async.status[0] << 8) | fifo_async.status[1];
+    if (fifo_async.status[2] & BIT_FIFO_OVERFLOW) {
+        /* Realign like fifo_realign, the partial packet is read out in the
+         * same transaction as the packets.
+         */
+        fifo_stats.overflows++;
+        fifo_async.overflow = 1;
+        skip = fifo_count % fifo_async.length;
+    }
+    fifo_count /= fifo_async.length;
+    fifo_async.packets = min(fifo_count, fifo_async.max_packets);
+    fifo_async.more = fifo_count - fifo_async.packets;
+    if (!fifo_async.packets) {
+        fifo_async_done(fifo_async.overflow ? -2 : 0);
+        return;
+    }
+
+    i2c_async_init(&fifo_async.data_req);
+    if ((skip && i2c_async_add_read(&fifo_async.data_req, st.hw->addr,
+            st.reg->fifo_r_w, skip, fifo_async.skip)) ||
+        i2c_async_add_read(&fifo_async.data_req, st.hw->addr,
+            st.reg->fifo_r_w, fifo_async.packets * fifo_async.length,
+            fifo_async.data) ||
+        i2c_async_schedule(&fifo_async.data_req, fifo_async_data_cb, NULL))
+        fifo_async_done(-1);
+}
+
+/**
+ *  @brief      Start a non-blocking read of unparsed packets from the FIFO.
+ *  FIFO_COUNT and INT_STATUS are read in one TWI transaction, then up to
+ *  @e max_packets packets are burst read into @e data. The CPU is free while
+ *  the transfers run.
+ *  \n TEMP_OUT is read in the same burst as INT_STATUS, see
+ *  @e mpu_get_temperature_fifo. With the DMP on and @e mpu_set_compass_fifo
+ *  enabled, the compass registers are read in the FIFO_COUNT transaction too.
+ *  \n @e callback is executed in the TWI interrupt context with the result,
+ *  the number of packets read, and the number of packets left in the FIFO.
+ *  A result of -2 means the FIFO overflowed. It is realigned as in
+ *  @e mpu_get_fifo_count and the packets read are valid, but packets were
+ *  lost before them.
+ *  @param[in]  length      Length of one FIFO packet.
+ *  @param[in]  max_packets Capacity of @e data in packets.
+ *  @param[out] data        FIFO packets. Must stay valid until @e callback.
+ *  @param[in]  callback    Completion callback.
+ *  @return     0 if the read was started.
+ */
+int mpu_read_fifo_stream_async(unsigned short length,
+    unsigned short max_packets, unsigned char *data, mpu_fifo_cb_t callback)
+{
+    if (!st.chip_cfg.sensors || !length || !max_packets || !callback)
+        return -1;
+    if (length > MAX_FIFO_PACKET_LENGTH)
+        return -1;
+    if (fifo_async.busy)
+        return -1;
+
+    fifo_async.length = length;
+    fifo_async.max_packets = max_packets;
+    fifo_async.data = data;
+    fifo_async.cb = callback;
+    fifo_async.packets = 0;
+    fifo_async.more = 0;
+    fifo_async.overflow = 0;
+
+    i2c_async_init(&fifo_async.count_req);
+    if (i2c_async_add_read(&fifo_async.count_req, st.hw->addr,
+            st.reg->fifo_count_h, 2, fifo_async.status) ||
+        i2c_async_add_read(&fifo_async.count_req, st.hw->addr,
+            st.reg->int_status, INT_STATUS_TO_TEMP_LENGTH,
+            fifo_async.status + 2))
+        return -1;
+#if defined AK89xx_SECONDARY && !defined AK89xx_BYPASS
+    /* The DMP packet has no room for the compass, grab the slave 0
+     * registers while we're at it.
+     */
+    fifo_async.read_compass = st.chip_cfg.compass_fifo && st.chip_cfg.dmp_on &&
+        (st.chip_cfg.sensors & INV_XYZ_COMPASS);
+    if (fifo_async.read_compass &&
+        i2c_async_add_read(&fifo_async.count_req, st.hw->addr,
+            st.reg->raw_compass, COMPASS_FIFO_LENGTH, fifo_async.compass))
+        return -1;
+#endif
+
+    fifo_async.busy = 1;
+    if (i2c_async_schedule(&fifo_async.count_req, fifo_async_count_cb, NULL)) {
+        fifo_async.busy = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ *  @brief      Get the time the last non-blocking FIFO read got FIFO_COUNT.
+ *  Packets written after it are not part of the read, they are left in the
+ *  FIFO for the next one.
+ *  @param[out] ticks   RTC time, see @e timestamp_ticks.
+ *  @return     0 if successful, -1 if a read is in flight.
+ */
+int mpu_get_fifo_count_ticks(uint64_t *ticks)
+{
+    if (fifo_async.busy)
+        return -1;
+    ticks[0] = fifo_async.count_ticks;
+    return 0;
+}
+
+/**
+ *  @brief      Get the temperature read by the last FIFO read.
+ *  @e mpu_read_fifo_stream_async reads TEMP_OUT in the same burst as
+ *  INT_STATUS, so a new value comes with every FIFO read at no extra bus
+ *  cost. Each value is returned once.
+ *  @param[out] data    Data in q16 format.
+ *  @return     0 if successful, -2 if there is no new value.
+ */
+int mpu_get_temperature_fifo(long *data)
+{
+    if (!fifo_temp.fresh)
+        return -2;
+    fifo_temp.fresh = 0;
+    data[0] = temp_to_q16(fifo_temp.raw);
+    return 0;
+}
+#endif
+
 /**
  *  @brief      Set device to bypass mode.
  *  @param[in]  bypass_on   1 to enable bypass mode.
@@ -1856,10 +2408,10 @@ int mpu_set_bypass(unsigned char bypass_on)
         return 0;
 
     if (bypass_on) {
-        if (i2c_read(st.hw->addr, st.reg->user_ctrl, 1, &tmp))
+        if (reg_read(st.reg->user_ctrl, 1, &tmp))
             return -1;
         tmp &= ~BIT_AUX_IF_EN;
-        if (i2c_write(st.hw->addr, st.reg->user_ctrl, 1, &tmp))
+        if (reg_write(st.reg->user_ctrl, 1, &tmp))
             return -1;
         delay_ms(3);
         tmp = BIT_BYPASS_EN;
@@ -1867,17 +2419,17 @@ int mpu_set_bypass(unsigned char bypass_on)
             tmp |= BIT_ACTL;
         if (st.chip_cfg.latched_int)
             tmp |= BIT_LATCH_EN | BIT_ANY_RD_CLR;
-        if (i2c_write(st.hw->addr, st.reg->int_pin_cfg, 1, &tmp))
+        if (reg_write(st.reg->int_pin_cfg, 1, &tmp))
             return -1;
     } else {
         /* Enable I2C master mode if compass is being used. */
-        if (i2c_read(st.hw->addr, st.reg->user_ctrl, 1, &tmp))
+        if (reg_read(st.reg->user_ctrl, 1, &tmp))
             return -1;
         if (st.chip_cfg.sensors & INV_XYZ_COMPASS)
             tmp |= BIT_AUX_IF_EN;
         else
             tmp &= ~BIT_AUX_IF_EN;
-        if (i2c_write(st.hw->addr, st.reg->user_ctrl, 1, &tmp))
+        if (reg_write(st.reg->user_ctrl, 1, &tmp))
             return -1;
         delay_ms(3);
         if (st.chip_cfg.active_low_int)
@@ -1886,7 +2438,7 @@ int mpu_set_bypass(unsigned char bypass_on)
             tmp = 0;
         if (st.chip_cfg.latched_int)
             tmp |= BIT_LATCH_EN | BIT_ANY_RD_CLR;
-        if (i2c_write(st.hw->addr, st.reg->int_pin_cfg, 1, &tmp))
+        if (reg_write(st.reg->int_pin_cfg, 1, &tmp))
             return -1;
     }
     st.chip_cfg.bypass_mode = bypass_on;
@@ -1924,7 +2476,7 @@ int mpu_set_int_latched(unsigned char enable)
         tmp |= BIT_BYPASS_EN;
     if (st.chip_cfg.active_low_int)
         tmp |= BIT_ACTL;
-    if (i2c_write(st.hw->addr, st.reg->int_pin_cfg, 1, &tmp))
+    if (reg_write(st.reg->int_pin_cfg, 1, &tmp))
         return -1;
     st.chip_cfg.latched_int = enable;
     return 0;
@@ -2079,57 +2631,57 @@ static int get_st_biases(long *gyro, long *accel, unsigned char hw_test)
 
     data[0] = 0x01;
     data[1] = 0;
-    if (i2c_write(st.hw->addr, st.reg->pwr_mgmt_1, 2, data))
+    if (reg_write(st.reg->pwr_mgmt_1, 2, data))
         return -1;
     delay_ms(200);
     data[0] = 0;
-    if (i2c_write(st.hw->addr, st.reg->int_enable, 1, data))
+    if (reg_write(st.reg->int_enable, 1, data))
         return -1;
-    if (i2c_write(st.hw->addr, st.reg->fifo_en, 1, data))
+    if (reg_write(st.reg->fifo_en, 1, data))
         return -1;
-    if (i2c_write(st.hw->addr, st.reg->pwr_mgmt_1, 1, data))
+    if (reg_write(st.reg->pwr_mgmt_1, 1, data))
         return -1;
-    if (i2c_write(st.hw->addr, st.reg->i2c_mst, 1, data))
+    if (reg_write(st.reg->i2c_mst, 1, data))
         return -1;
-    if (i2c_write(st.hw->addr, st.reg->user_ctrl, 1, data))
+    if (reg_write(st.reg->user_ctrl, 1, data))
         return -1;
     data[0] = BIT_FIFO_RST | BIT_DMP_RST;
-    if (i2c_write(st.hw->addr, st.reg->user_ctrl, 1, data))
+    if (reg_write(st.reg->user_ctrl, 1, data))
         return -1;
     delay_ms(15);
     data[0] = st.test->reg_lpf;
-    if (i2c_write(st.hw->addr, st.reg->lpf, 1, data))
+    if (reg_write(st.reg->lpf, 1, data))
         return -1;
     data[0] = st.test->reg_rate_div;
-    if (i2c_write(st.hw->addr, st.reg->rate_div, 1, data))
+    if (reg_write(st.reg->rate_div, 1, data))
         return -1;
     if (hw_test)
         data[0] = st.test->reg_gyro_fsr | 0xE0;
     else
         data[0] = st.test->reg_gyro_fsr;
-    if (i2c_write(st.hw->addr, st.reg->gyro_cfg, 1, data))
+    if (reg_write(st.reg->gyro_cfg, 1, data))
         return -1;
 
     if (hw_test)
         data[0] = st.test->reg_accel_fsr | 0xE0;
     else
         data[0] = test.reg_accel_fsr;
-    if (i2c_write(st.hw->addr, st.reg->accel_cfg, 1, data))
+    if (reg_write(st.reg->accel_cfg, 1, data))
         return -1;
     if (hw_test)
         delay_ms(200);
 
     /* Fill FIFO for test.wait_ms milliseconds. */
     data[0] = BIT_FIFO_EN;
-    if (i2c_write(st.hw->addr, st.reg->user_ctrl, 1, data))
+    if (reg_write(st.reg->user_ctrl, 1, data))
         return -1;
 
     data[0] = INV_XYZ_GYRO | INV_XYZ_ACCEL;
-    if (i2c_write(st.hw->addr, st.reg->fifo_en, 1, data))
+    if (reg_write(st.reg->fifo_en, 1, data))
         return -1;
     delay_ms(test.wait_ms);
     data[0] = 0;
-    if (i2c_write(st.hw->addr, st.reg->fifo_en, 1, data))
+    if (reg_write(st.reg->fifo_en, 1, data))
         return -1;
 
     if (i2c_read(st.hw->addr, st.reg->fifo_count_h, 2, data))
@@ -2420,52 +2972,52 @@ static int get_st_6500_biases(long *gyro, long *accel, unsigned char hw_test, in
 
     data[0] = 0x01;
     data[1] = 0;
-    if (i2c_write(st.hw->addr, st.reg->pwr_mgmt_1, 2, data))
+    if (reg_write(st.reg->pwr_mgmt_1, 2, data))
         return -1;
     delay_ms(200);
     data[0] = 0;
-    if (i2c_write(st.hw->addr, st.reg->int_enable, 1, data))
+    if (reg_write(st.reg->int_enable, 1, data))
         return -1;
-    if (i2c_write(st.hw->addr, st.reg->fifo_en, 1, data))
+    if (reg_write(st.reg->fifo_en, 1, data))
         return -1;
-    if (i2c_write(st.hw->addr, st.reg->pwr_mgmt_1, 1, data))
+    if (reg_write(st.reg->pwr_mgmt_1, 1, data))
         return -1;
-    if (i2c_write(st.hw->addr, st.reg->i2c_mst, 1, data))
+    if (reg_write(st.reg->i2c_mst, 1, data))
         return -1;
-    if (i2c_write(st.hw->addr, st.reg->user_ctrl, 1, data))
+    if (reg_write(st.reg->user_ctrl, 1, data))
         return -1;
     data[0] = BIT_FIFO_RST | BIT_DMP_RST;
-    if (i2c_write(st.hw->addr, st.reg->user_ctrl, 1, data))
+    if (reg_write(st.reg->user_ctrl, 1, data))
         return -1;
     delay_ms(15);
     data[0] = st.test->reg_lpf;
-    if (i2c_write(st.hw->addr, st.reg->lpf, 1, data))
+    if (reg_write(st.reg->lpf, 1, data))
         return -1;
     data[0] = st.test->reg_rate_div;
-    if (i2c_write(st.hw->addr, st.reg->rate_div, 1, data))
+    if (reg_write(st.reg->rate_div, 1, data))
         return -1;
     if (hw_test)
         data[0] = st.test->reg_gyro_fsr | 0xE0;
     else
         data[0] = st.test->reg_gyro_fsr;
-    if (i2c_write(st.hw->addr, st.reg->gyro_cfg, 1, data))
+    if (reg_write(st.reg->gyro_cfg, 1, data))
         return -1;
 
     if (hw_test)
         data[0] = st.test->reg_accel_fsr | 0xE0;
     else
         data[0] = test.reg_accel_fsr;
-    if (i2c_write(st.hw->addr, st.reg->accel_cfg, 1, data))
+    if (reg_write(st.reg->accel_cfg, 1, data))
         return -1;
 
     delay_ms(test.wait_ms);  //wait 200ms for sensors to stabilize
 
     /* Enable FIFO */
     data[0] = BIT_FIFO_EN;
-    if (i2c_write(st.hw->addr, st.reg->user_ctrl, 1, data))
+    if (reg_write(st.reg->user_ctrl, 1, data))
         return -1;
     data[0] = INV_XYZ_GYRO | INV_XYZ_ACCEL;
-    if (i2c_write(st.hw->addr, st.reg->fifo_en, 1, data))
+    if (reg_write(st.reg->fifo_en, 1, data))
         return -1;
 
     //initialize the bias return values
@@ -2514,7 +3066,7 @@ static int get_st_6500_biases(long *gyro, long *accel, unsigned char hw_test, in
 
     //stop FIFO
     data[0] = 0;
-    if (i2c_write(st.hw->addr, st.reg->fifo_en, 1, data))
+    if (reg_write(st.reg->fifo_en, 1, data))
         return -1;
 
     gyro[0] = (long)(((long long)gyro[0]<<16) / test.gyro_sens / s);
@@ -2797,9 +3349,9 @@ int mpu_write_mem(unsigned short mem_addr, unsigned short length,
     if (tmp[1] + length > st.hw->bank_size)
         return -1;
 
-    if (i2c_write(st.hw->addr, st.reg->bank_sel, 2, tmp))
+    if (reg_write(st.reg->bank_sel, 2, tmp))
         return -1;
-    if (i2c_write(st.hw->addr, st.reg->mem_r_w, length, data))
+    if (reg_write(st.reg->mem_r_w, length, data))
         return -1;
     return 0;
 }
@@ -2830,7 +3382,7 @@ int mpu_read_mem(unsigned short mem_addr, unsigned short length,
     if (tmp[1] + length > st.hw->bank_size)
         return -1;
 
-    if (i2c_write(st.hw->addr, st.reg->bank_sel, 2, tmp))
+    if (reg_write(st.reg->bank_sel, 2, tmp))
         return -1;
     if (i2c_read(st.hw->addr, st.reg->mem_r_w, length, data))
         return -1;
@@ -2839,6 +3391,9 @@ int mpu_read_mem(unsigned short mem_addr, unsigned short length,
 
 /**
  *  @brief      Load and verify DMP image.
+ *  On nRF52 the image is written in bank-aligned chunks as large as one I2C
+ *  write allows and verified in a single read-back pass once it is all in
+ *  place. The upload time is logged.
  *  @param[in]  length      Length of DMP image.
  *  @param[in]  firmware    DMP code.
  *  @param[in]  start_addr  Starting address of DMP code memory.
@@ -2851,8 +3406,14 @@ int mpu_load_firmware(unsigned short length, const unsigned char *firmware,
     unsigned short ii;
     unsigned short this_write;
     /* Must divide evenly into st.hw->bank_size to avoid bank crossings. */
+#if defined NRF52
+#define LOAD_CHUNK  (I2C_WRITE_MAX_LENGTH)
+#define LOAD_VERIFY_PASS
+#else
 #define LOAD_CHUNK  (16)
+#endif
     unsigned char cur[LOAD_CHUNK], tmp[2];
+    unsigned long start_ms, end_ms;
 
     if (st.chip_cfg.dmp_loaded)
         /* DMP should only be loaded once. */
@@ -2860,22 +3421,38 @@ int mpu_load_firmware(unsigned short length, const unsigned char *firmware,
 
     if (!firmware)
         return -1;
+    get_ms(&start_ms);
     for (ii = 0; ii < length; ii += this_write) {
         this_write = min(LOAD_CHUNK, length - ii);
         if (mpu_write_mem(ii, this_write, (unsigned char*)&firmware[ii]))
             return -1;
+#ifndef LOAD_VERIFY_PASS
+        if (mpu_read_mem(ii, this_write, cur))
+            return -1;
+        if (memcmp(firmware+ii, cur, this_write))
+            return -2;
+#endif
+    }
+#ifdef LOAD_VERIFY_PASS
+    /* One read-back pass over the whole image. */
+    for (ii = 0; ii < length; ii += this_write) {
+        this_write = min(LOAD_CHUNK, length - ii);
         if (mpu_read_mem(ii, this_write, cur))
             return -1;
         if (memcmp(firmware+ii, cur, this_write))
             return -2;
     }
+#endif
 
     /* Set program start address. */
     tmp[0] = start_addr >> 8;
     tmp[1] = start_addr & 0xFF;
-    if (i2c_write(st.hw->addr, st.reg->prgm_start_h, 2, tmp))
+    if (reg_write(st.reg->prgm_start_h, 2, tmp))
         return -1;
 
+    get_ms(&end_ms);
+    log_i("DMP loaded in %lu ms.\n", end_ms - start_ms);
+
     st.chip_cfg.dmp_loaded = 1;
     st.chip_cfg.dmp_sample_rate = sample_rate;
     return 0;
@@ -2903,7 +3480,7 @@ int mpu_set_dmp_state(unsigned char enable)
         mpu_set_sample_rate(st.chip_cfg.dmp_sample_rate);
         /* Remove FIFO elements. */
         tmp = 0;
-        i2c_write(st.hw->addr, 0x23, 1, &tmp);
+        reg_write(0x23, 1, &tmp);
         st.chip_cfg.dmp_on = 1;
         /* Enable DMP interrupt. */
         set_int_enable(1);
@@ -2913,7 +3490,7 @@ int mpu_set_dmp_state(unsigned char enable)
         set_int_enable(0);
         /* Restore FIFO settings. */
         tmp = st.chip_cfg.fifo_enable;
-        i2c_write(st.hw->addr, 0x23, 1, &tmp);
+        reg_write(0x23, 1, &tmp);
         st.chip_cfg.dmp_on = 0;
         mpu_reset_fifo();
     }
@@ -2981,53 +3558,53 @@ static int setup_compass(void)
 
     /* Set up master mode, master clock, and ES bit. */
     data[0] = 0x40;
-    if (i2c_write(st.hw->addr, st.reg->i2c_mst, 1, data))
+    if (reg_write(st.reg->i2c_mst, 1, data))
         return -1;
 
     /* Slave 0 reads from AKM data registers. */
     data[0] = BIT_I2C_READ | st.chip_cfg.compass_addr;
-    if (i2c_write(st.hw->addr, st.reg->s0_addr, 1, data))
+    if (reg_write(st.reg->s0_addr, 1, data))
         return -1;
 
     /* Compass reads start at this register. */
     data[0] = AKM_REG_ST1;
-    if (i2c_write(st.hw->addr, st.reg->s0_reg, 1, data))
+    if (reg_write(st.reg->s0_reg, 1, data))
         return -1;
 
     /* Enable slave 0, 8-byte reads. */
     data[0] = BIT_SLAVE_EN | 8;
-    if (i2c_write(st.hw->addr, st.reg->s0_ctrl, 1, data))
+    if (reg_write(st.reg->s0_ctrl, 1, data))
         return -1;
 
     /* Slave 1 changes AKM measurement mode. */
     data[0] = st.chip_cfg.compass_addr;
-    if (i2c_write(st.hw->addr, st.reg->s1_addr, 1, data))
+    if (reg_write(st.reg->s1_addr, 1, data))
         return -1;
 
     /* AKM measurement mode register. */
     data[0] = AKM_REG_CNTL;
-    if (i2c_write(st.hw->addr, st.reg->s1_reg, 1, data))
+    if (reg_write(st.reg->s1_reg, 1, data))
         return -1;
 
     /* Enable slave 1, 1-byte writes. */
     data[0] = BIT_SLAVE_EN | 1;
-    if (i2c_write(st.hw->addr, st.reg->s1_ctrl, 1, data))
+    if (reg_write(st.reg->s1_ctrl, 1, data))
         return -1;
 
     /* Set slave 1 data. */
     data[0] = AKM_SINGLE_MEASUREMENT;
-    if (i2c_write(st.hw->addr, st.reg->s1_do, 1, data))
+    if (reg_write(st.reg->s1_do, 1, data))
         return -1;
 
     /* Trigger slave 0 and slave 1 actions at each sample. */
     data[0] = 0x03;
-    if (i2c_write(st.hw->addr, st.reg->i2c_delay_ctrl, 1, data))
+    if (reg_write(st.reg->i2c_delay_ctrl, 1, data))
         return -1;
 
 #ifdef MPU9150
     /* For the MPU9150, the auxiliary I2C bus needs to be set to VDD. */
     data[0] = BIT_I2C_MST_VDDIO;
-    if (i2c_write(st.hw->addr, st.reg->yg_offs_tc, 1, data))
+    if (reg_write(st.reg->yg_offs_tc, 1, data))
         return -1;
 #endif
 
@@ -3035,6 +3612,39 @@ static int setup_compass(void)
 }
 #endif
 
+#ifdef AK89xx_SECONDARY
+/**
+ *  @brief      Decode the ST1..ST2 register block of the compass.
+ *  @param[in]  tmp     Raw registers, eight bytes starting at ST1.
+ *  @param[out] data    Raw data in hardware units.
+ *  @return     0 if successful, -2 if not ready, -3 on sensor overflow.
+ */
+static int decode_compass(const unsigned char *tmp, short *data)
+{
+#if defined AK8975_SECONDARY
+    /* AK8975 doesn't have the overrun error bit. */
+    if (!(tmp[0] & AKM_DATA_READY))
+        return -2;
+    if ((tmp[7] & AKM_OVERFLOW) || (tmp[7] & AKM_DATA_ERROR))
+        return -3;
+#elif defined AK8963_SECONDARY
+    /* AK8963 doesn't have the data read error bit. */
+    if (!(tmp[0] & AKM_DATA_READY) || (tmp[0] & AKM_DATA_OVERRUN))
+        return -2;
+    if (tmp[7] & AKM_OVERFLOW)
+        return -3;
+#endif
+    data[0] = (tmp[2] << 8) | tmp[1];
+    data[1] = (tmp[4] << 8) | tmp[3];
+    data[2] = (tmp[6] << 8) | tmp[5];
+
+    data[0] = ((long)data[0] * st.chip_cfg.mag_sens_adj[0]) >> 8;
+    data[1] = ((long)data[1] * st.chip_cfg.mag_sens_adj[1]) >> 8;
+    data[2] = ((long)data[2] * st.chip_cfg.mag_sens_adj[2]) >> 8;
+    return 0;
+}
+#endif
+
 /**
  *  @brief      Read raw compass data.
  *  @param[out] data        Raw data in hardware units.
@@ -3045,6 +3655,7 @@ int mpu_get_compass_reg(short *data, unsigned long *timestamp)
 {
 #ifdef AK89xx_SECONDARY
     unsigned char tmp[9];
+    int result;
 
     if (!(st.chip_cfg.sensors & INV_XYZ_COMPASS))
         return -1;
@@ -3060,29 +3671,134 @@ int mpu_get_compass_reg(short *data, unsigned long *timestamp)
         return -1;
 #endif
 
-#if defined AK8975_SECONDARY
-    /* AK8975 doesn't have the overrun error bit. */
-    if (!(tmp[0] & AKM_DATA_READY))
+    result = decode_compass(tmp, data);
+    if (result)
+        return result;
+
+    if (timestamp)
+        get_ms(timestamp);
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+#if defined NRF52 && defined AK89xx_SECONDARY && !defined AK89xx_BYPASS
+static struct {
+    i2c_async_t req;
+    unsigned char raw[8];
+    short data[3];
+    mpu_compass_cb_t cb;
+    volatile unsigned char busy;
+} compass_async;
+
+static void compass_async_cb(ret_code_t result, void *p_context)
+{
+    int err = -1;
+
+    if (result == NRF_SUCCESS)
+        err = decode_compass(compass_async.raw, compass_async.data);
+    compass_async.busy = 0;
+    compass_async.cb(err, compass_async.data);
+}
+#endif
+
+/**
+ *  @brief      Start a non-blocking read of the compass registers.
+ *  @e callback is executed in the TWI interrupt context with the same result
+ *  codes as @e mpu_get_compass_reg and the compass data in hardware units.
+ *  Not available in bypass mode.
+ *  @param[in]  callback    Completion callback.
+ *  @return     0 if the read was started.
+ */
+int mpu_get_compass_reg_async(mpu_compass_cb_t callback)
+{
+#if defined AK89xx_SECONDARY && !defined AK89xx_BYPASS
+    if (!(st.chip_cfg.sensors & INV_XYZ_COMPASS) || !callback)
+        return -1;
+    if (compass_async.busy)
+        return -1;
+
+    compass_async.cb = callback;
+    i2c_async_init(&compass_async.req);
+    if (i2c_async_add_read(&compass_async.req, st.hw->addr,
+            st.reg->raw_compass, 8, compass_async.raw))
+        return -1;
+
+    compass_async.busy = 1;
+    if (i2c_async_schedule(&compass_async.req, compass_async_cb, NULL)) {
+        compass_async.busy = 0;
+        return -1;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+#if defined AK89xx_SECONDARY && !defined AK89xx_BYPASS
+/* Last compass sample read along with the FIFO. */
+static struct {
+    unsigned char raw[COMPASS_FIFO_LENGTH];
+    short data[3];
+    unsigned char fresh;
+} compass_fifo;
+
+/* The slave 0 registers are sampled at the gyro rate but only refreshed at
+ * the compass rate, so a block identical to the last one is not a new sample.
+ */
+static int compass_fifo_store(const unsigned char *raw)
+{
+    if (!memcmp(raw, compass_fifo.raw, COMPASS_FIFO_LENGTH))
         return -2;
-    if ((tmp[7] & AKM_OVERFLOW) || (tmp[7] & AKM_DATA_ERROR))
-        return -3;
-#elif defined AK8963_SECONDARY
-    /* AK8963 doesn't have the data read error bit. */
-    if (!(tmp[0] & AKM_DATA_READY) || (tmp[0] & AKM_DATA_OVERRUN))
+    memcpy(compass_fifo.raw, raw, COMPASS_FIFO_LENGTH);
+    if (decode_compass(raw, compass_fifo.data))
         return -2;
-    if (tmp[7] & AKM_OVERFLOW)
-        return -3;
+    compass_fifo.fresh = 1;
+    return 0;
+}
 #endif
-    data[0] = (tmp[2] << 8) | tmp[1];
-    data[1] = (tmp[4] << 8) | tmp[3];
-    data[2] = (tmp[6] << 8) | tmp[5];
 
-    data[0] = ((long)data[0] * st.chip_cfg.mag_sens_adj[0]) >> 8;
-    data[1] = ((long)data[1] * st.chip_cfg.mag_sens_adj[1]) >> 8;
-    data[2] = ((long)data[2] * st.chip_cfg.mag_sens_adj[2]) >> 8;
+/**
+ *  @brief      Read the compass along with the FIFO.
+ *  Without the DMP, slave 0 of the auxiliary I2C master is added to the FIFO,
+ *  so every packet carries the compass registers sampled with the gyro and
+ *  accel data, and @e mpu_read_fifo parses them. The DMP packet layout is
+ *  fixed by the DMP image, so with the DMP on the registers are read in the
+ *  FIFO_COUNT transaction of @e mpu_read_fifo_stream_async instead.
+ *  \n Either way, no separate compass transaction is needed. New samples
+ *  are fetched with @e mpu_get_compass_fifo. Not available in bypass mode.
+ *  @param[in]  enable  1 to enable.
+ *  @return     0 if successful.
+ */
+int mpu_set_compass_fifo(unsigned char enable)
+{
+#if defined AK89xx_SECONDARY && !defined AK89xx_BYPASS
+    st.chip_cfg.compass_fifo = enable;
+    memset(&compass_fifo, 0, sizeof(compass_fifo));
+    if (st.chip_cfg.dmp_on || !st.chip_cfg.fifo_enable)
+        return 0;
+    return mpu_configure_fifo(st.chip_cfg.fifo_enable);
+#else
+    return -1;
+#endif
+}
 
-    if (timestamp)
-        get_ms(timestamp);
+/**
+ *  @brief      Get the newest compass sample read along with the FIFO.
+ *  Each sample is returned once.
+ *  @param[out] data    Raw data in hardware units.
+ *  @return     0 if successful, -2 if there is no new sample.
+ */
+int mpu_get_compass_fifo(short *data)
+{
+#if defined AK89xx_SECONDARY && !defined AK89xx_BYPASS
+    if (!compass_fifo.fresh)
+        return -2;
+    compass_fifo.fresh = 0;
+    data[0] = compass_fifo.data[0];
+    data[1] = compass_fifo.data[1];
+    data[2] = compass_fifo.data[2];
     return 0;
 #else
     return -1;
@@ -3197,12 +3913,12 @@ int mpu_lp_motion_interrupt(unsigned short thresh, unsigned char time,
         data[0] = 0;
         data[1] = 0;
         data[2] = BIT_STBY_XYZG;
-        if (i2c_write(st.hw->addr, st.reg->user_ctrl, 3, data))
+        if (reg_write(st.reg->user_ctrl, 3, data))
             goto lp_int_restore;
 
         /* Set motion threshold. */
         data[0] = thresh_hw;
-        if (i2c_write(st.hw->addr, st.reg->motion_thr, 1, data))
+        if (reg_write(st.reg->motion_thr, 1, data))
             goto lp_int_restore;
 
         /* Set wake frequency. */
@@ -3226,22 +3942,22 @@ int mpu_lp_motion_interrupt(unsigned short thresh, unsigned char time,
             data[0] = INV_LPA_320HZ;
         else
             data[0] = INV_LPA_640HZ;
-        if (i2c_write(st.hw->addr, st.reg->lp_accel_odr, 1, data))
+        if (reg_write(st.reg->lp_accel_odr, 1, data))
             goto lp_int_restore;
 
         /* Enable motion interrupt (MPU6500 version). */
         data[0] = BITS_WOM_EN;
-        if (i2c_write(st.hw->addr, st.reg->accel_intel, 1, data))
+        if (reg_write(st.reg->accel_intel, 1, data))
             goto lp_int_restore;
 
         /* Enable cycle mode. */
         data[0] = BIT_LPA_CYCLE;
-        if (i2c_write(st.hw->addr, st.reg->pwr_mgmt_1, 1, data))
+        if (reg_write(st.reg->pwr_mgmt_1, 1, data))
             goto lp_int_restore;
 
         /* Enable interrupt. */
         data[0] = BIT_MOT_INT_EN;
-        if (i2c_write(st.hw->addr, st.reg->int_enable, 1, data))
+        if (reg_write(st.reg->int_enable, 1, data))
             goto lp_int_restore;
 
         st.chip_cfg.int_motion_only = 1;
@@ -3280,7 +3996,7 @@ lp_int_restore:
 #ifdef MPU6500
     /* Disable motion interrupt (MPU6500 version). */
     data[0] = 0;
-    if (i2c_write(st.hw->addr, st.reg->accel_intel, 1, data))
+    if (reg_write(st.reg->accel_intel, 1, data))
         goto lp_int_restore;
 #endif
 
@@ -115,6 +115,8 @@ int mpu_set_accel_bias_6050_reg(const long *accel_bias);
 int mpu_get_gyro_reg(short *data, unsigned long *timestamp);
 int mpu_get_accel_reg(short *data, unsigned long *timestamp);
 int mpu_get_compass_reg(short *data, unsigned long *timestamp);
+int mpu_set_compass_fifo(unsigned char enable);
+int mpu_get_compass_fifo(short *data);
 int mpu_get_temperature(long *data, unsigned long *timestamp);
 
 int mpu_get_int_status(short *status);
@@ -122,7 +124,25 @@ int mpu_read_fifo(short *gyro, short *accel, unsigned long *timestamp,
     unsigned char *sensors, unsigned char *more);
 int mpu_read_fifo_stream(unsigned short length, unsigned char *data,
     unsigned char *more);
+int mpu_get_fifo_count(unsigned short length, unsigned short *count);
+int mpu_get_fifo_size(unsigned short *size);
+int mpu_read_fifo_packets(unsigned short length, unsigned short packets,
+    unsigned char *data);
 int mpu_reset_fifo(void);
+int mpu_get_fifo_stats(unsigned long *overflows, unsigned long *resets);
+
+#if defined NRF52
+/* Non-blocking APIs. Callbacks are executed in the TWI interrupt context. */
+typedef void (*mpu_fifo_cb_t)(int result, unsigned short packets,
+    unsigned short more);
+typedef void (*mpu_compass_cb_t)(int result, short *data);
+
+int mpu_read_fifo_stream_async(unsigned short length,
+    unsigned short max_packets, unsigned char *data, mpu_fifo_cb_t callback);
+int mpu_get_compass_reg_async(mpu_compass_cb_t callback);
+int mpu_get_temperature_fifo(long *data);
+int mpu_get_fifo_count_ticks(uint64_t *ticks);
+#endif
 
 int mpu_write_mem(unsigned short mem_addr, unsigned short length,
     unsigned char *data);
@@ -133,6 +153,7 @@ int mpu_load_firmware(unsigned short length, const unsigned char *firmware,
 
 int mpu_reg_dump(void);
 int mpu_read_reg(unsigned char reg, unsigned char *data);
+int mpu_get_shadow_stats(unsigned long *hits, unsigned long *misses);
 int mpu_run_self_test(long *gyro, long *accel);
 int mpu_run_6500_self_test(long *gyro, long *accel, unsigned char debug);
 int mpu_register_tap_cb(void (*func)(unsigned char, unsigned char));
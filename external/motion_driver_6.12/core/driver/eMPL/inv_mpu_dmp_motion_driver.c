@@ -474,6 +474,16 @@ static const unsigned short sStartAddress = 0x0400;
                                      DMP_FEATURE_SEND_CAL_GYRO)
 
 #define MAX_PACKET_LENGTH   (32)
+/* Packets per burst in dmp_read_fifo_batch. Seven 32-byte packets fit in a
+ * single 255-byte I2C read.
+ */
+#define DMP_BATCH_BURST_PACKETS (7)
+/* Read buffer of dmp_read_fifo_async, half of the 1024-byte FIFO. */
+#define DMP_ASYNC_MAX_PACKETS   (16)
+/* Packets that must decode to unit quaternions before an alignment found by
+ * fifo_resync is accepted.
+ */
+#define RESYNC_CHECK_PACKETS    (2)
 
 #define DMP_SAMPLE_RATE     (200)
 #define GYRO_SF             (46850825LL * 200 / DMP_SAMPLE_RATE)
@@ -493,6 +503,7 @@ struct dmp_s {
     unsigned short feature_mask;
     unsigned short fifo_rate;
     unsigned char packet_length;
+    unsigned long resyncs;
 };
 
 static struct dmp_s dmp = {
@@ -501,7 +512,8 @@ static struct dmp_s dmp = {
     .orient = 0,
     .feature_mask = 0,
     .fifo_rate = 0,
-    .packet_length = 0
+    .packet_length = 0,
+    .resyncs = 0
 };
 
 /**
@@ -1216,6 +1228,18 @@ static int decode_gesture(unsigned char *gesture)
     return 0;
 }
 
+/**
+ *  @brief      Get the length of one FIFO packet.
+ *  The length depends on the features enabled with @e dmp_enable_feature.
+ *  @param[out] length  Packet length in bytes.
+ *  @return     0 if successful.
+ */
+int dmp_get_packet_length(unsigned char *length)
+{
+    length[0] = dmp.packet_length;
+    return 0;
+}
+
 /**
  *  @brief      Specify when a DMP interrupt should occur.
  *  A DMP interrupt can be configured to trigger on either of the two
@@ -1244,74 +1268,129 @@ int dmp_set_interrupt_mode(unsigned char mode)
     }
 }
 
+/* Decode the quaternion at the head of a DMP packet. */
+static void get_packet_quat(const unsigned char *fifo_data, long *quat)
+{
+    quat[0] = ((long)fifo_data[0] << 24) | ((long)fifo_data[1] << 16) |
+        ((long)fifo_data[2] << 8) | fifo_data[3];
+    quat[1] = ((long)fifo_data[4] << 24) | ((long)fifo_data[5] << 16) |
+        ((long)fifo_data[6] << 8) | fifo_data[7];
+    quat[2] = ((long)fifo_data[8] << 24) | ((long)fifo_data[9] << 16) |
+        ((long)fifo_data[10] << 8) | fifo_data[11];
+    quat[3] = ((long)fifo_data[12] << 24) | ((long)fifo_data[13] << 16) |
+        ((long)fifo_data[14] << 8) | fifo_data[15];
+}
+
+#ifdef FIFO_CORRUPTION_CHECK
+/* We can detect a corrupted FIFO by monitoring the quaternion data and
+ * ensuring that the magnitude is always normalized to one. This shouldn't
+ * happen in normal operation, but if an I2C error occurs, the FIFO reads
+ * might become misaligned.
+ */
+static int quat_is_unit(const long *quat)
+{
+    long quat_q14[4], quat_mag_sq;
+
+    /* Let's start by scaling down the quaternion data to avoid long long
+     * math.
+     */
+    quat_q14[0] = quat[0] >> 16;
+    quat_q14[1] = quat[1] >> 16;
+    quat_q14[2] = quat[2] >> 16;
+    quat_q14[3] = quat[3] >> 16;
+    quat_mag_sq = quat_q14[0] * quat_q14[0] + quat_q14[1] * quat_q14[1] +
+        quat_q14[2] * quat_q14[2] + quat_q14[3] * quat_q14[3];
+    return (quat_mag_sq >= QUAT_MAG_SQ_MIN) &&
+        (quat_mag_sq <= QUAT_MAG_SQ_MAX);
+}
+#endif
+
 /**
- *  @brief      Get one packet from the FIFO.
- *  If @e sensors does not contain a particular sensor, disregard the data
- *  returned to that pointer.
- *  \n @e sensors can contain a combination of the following flags:
- *  \n INV_X_GYRO, INV_Y_GYRO, INV_Z_GYRO
- *  \n INV_XYZ_GYRO
- *  \n INV_XYZ_ACCEL
- *  \n INV_WXYZ_QUAT
- *  \n If the FIFO has no new data, @e sensors will be zero.
- *  \n If the FIFO is disabled, @e sensors will be zero and this function will
- *  return a non-zero error code.
+ *  @brief      Recover the packet alignment after a corrupted packet.
+ *  Instead of resetting the FIFO, scan the bytes read so far for the offset
+ *  where the stream decodes to unit quaternions again. That many bytes are
+ *  then read from the FIFO into the end of @e data, so the last packet in the
+ *  buffer is whole and the FIFO is aligned for the next read. Only the packet
+ *  the misalignment happened in is lost.
+ *  \n Since the DMP writes whole packets, a FIFO read @e offset bytes into a
+ *  packet always holds at least @e offset more bytes.
+ *  @param[in,out]  data    Corrupted packet, followed by the rest of the
+ *                          buffer and room for one more packet.
+ *  @param[in]      bytes   Number of bytes read into @e data.
+ *  @return     Offset of the first aligned packet in @e data, or -1 if no
+ *              alignment was found and the FIFO has to be reset.
+ */
+static int fifo_resync(unsigned char *data, unsigned short bytes)
+{
+#ifdef FIFO_CORRUPTION_CHECK
+    unsigned short offset, pos;
+    unsigned char checked = 0;
+    long quat[4];
+
+    if (!(dmp.feature_mask & (DMP_FEATURE_LP_QUAT | DMP_FEATURE_6X_LP_QUAT)))
+        return -1;
+
+    for (offset = 1; offset < dmp.packet_length; offset++) {
+        checked = 0;
+        for (pos = offset; (pos + 16 <= bytes) &&
+            (checked < RESYNC_CHECK_PACKETS); pos += dmp.packet_length) {
+            get_packet_quat(data + pos, quat);
+            if (!quat_is_unit(quat)) {
+                checked = 0;
+                break;
+            }
+            checked++;
+        }
+        if (checked)
+            break;
+    }
+    if (!checked)
+        return -1;
+
+    if (mpu_read_fifo_packets(offset, 1, data + bytes))
+        return -1;
+    dmp.resyncs++;
+    log_i("FIFO resync, offset %d.\n", offset);
+    return offset;
+#else
+    return -1;
+#endif
+}
+
+/**
+ *  @brief      Get the number of FIFO realignments done by the read functions.
+ *  @param[out] count   Number of times the FIFO was resynchronized instead of
+ *                      reset.
+ *  @return     0 if successful.
+ */
+int dmp_get_resync_count(unsigned long *count)
+{
+    count[0] = dmp.resyncs;
+    return 0;
+}
+
+/**
+ *  @brief      Parse one DMP packet.
+ *  @param[in]  fifo_data   Raw packet, @e dmp.packet_length bytes.
  *  @param[out] gyro        Gyro data in hardware units.
  *  @param[out] accel       Accel data in hardware units.
  *  @param[out] quat        3-axis quaternion data in hardware units.
- *  @param[out] timestamp   Timestamp in milliseconds.
- *  @param[out] sensors     Mask of sensors read from FIFO.
- *  @param[out] more        Number of remaining packets.
- *  @return     0 if successful.
+ *  @param[out] sensors     Mask of sensors found in the packet.
+ *  @return     0 if successful, -1 if the packet failed the corruption check.
  */
-int dmp_read_fifo(short *gyro, short *accel, long *quat,
-    unsigned long *timestamp, short *sensors, unsigned char *more)
+static int parse_packet(unsigned char *fifo_data, short *gyro, short *accel,
+    long *quat, short *sensors)
 {
-    unsigned char fifo_data[MAX_PACKET_LENGTH];
     unsigned char ii = 0;
 
-    /* TODO: sensors[0] only changes when dmp_enable_feature is called. We can
-     * cache this value and save some cycles.
-     */
     sensors[0] = 0;
 
-    /* Get a packet. */
-    if (mpu_read_fifo_stream(dmp.packet_length, fifo_data, more))
-        return -1;
-
-    /* Parse DMP packet. */
     if (dmp.feature_mask & (DMP_FEATURE_LP_QUAT | DMP_FEATURE_6X_LP_QUAT)) {
-#ifdef FIFO_CORRUPTION_CHECK
-        long quat_q14[4], quat_mag_sq;
-#endif
-        quat[0] = ((long)fifo_data[0] << 24) | ((long)fifo_data[1] << 16) |
-            ((long)fifo_data[2] << 8) | fifo_data[3];
-        quat[1] = ((long)fifo_data[4] << 24) | ((long)fifo_data[5] << 16) |
-            ((long)fifo_data[6] << 8) | fifo_data[7];
-        quat[2] = ((long)fifo_data[8] << 24) | ((long)fifo_data[9] << 16) |
-            ((long)fifo_data[10] << 8) | fifo_data[11];
-        quat[3] = ((long)fifo_data[12] << 24) | ((long)fifo_data[13] << 16) |
-            ((long)fifo_data[14] << 8) | fifo_data[15];
+        get_packet_quat(fifo_data, quat);
         ii += 16;
 #ifdef FIFO_CORRUPTION_CHECK
-        /* We can detect a corrupted FIFO by monitoring the quaternion data and
-         * ensuring that the magnitude is always normalized to one. This
-         * shouldn't happen in normal operation, but if an I2C error occurs,
-         * the FIFO reads might become misaligned.
-         *
-         * Let's start by scaling down the quaternion data to avoid long long
-         * math.
-         */
-        quat_q14[0] = quat[0] >> 16;
-        quat_q14[1] = quat[1] >> 16;
-        quat_q14[2] = quat[2] >> 16;
-        quat_q14[3] = quat[3] >> 16;
-        quat_mag_sq = quat_q14[0] * quat_q14[0] + quat_q14[1] * quat_q14[1] +
-            quat_q14[2] * quat_q14[2] + quat_q14[3] * quat_q14[3];
-        if ((quat_mag_sq < QUAT_MAG_SQ_MIN) ||
-            (quat_mag_sq > QUAT_MAG_SQ_MAX)) {
+        if (!quat_is_unit(quat)) {
             /* Quaternion is outside of the acceptable threshold. */
-            mpu_reset_fifo();
             sensors[0] = 0;
             return -1;
         }
@@ -1341,10 +1420,267 @@ int dmp_read_fifo(short *gyro, short *accel, long *quat,
     if (dmp.feature_mask & (DMP_FEATURE_TAP | DMP_FEATURE_ANDROID_ORIENT))
         decode_gesture(fifo_data + ii);
 
+    return 0;
+}
+
+/**
+ *  @brief      Get one packet from the FIFO.
+ *  If @e sensors does not contain a particular sensor, disregard the data
+ *  returned to that pointer.
+ *  \n @e sensors can contain a combination of the following flags:
+ *  \n INV_X_GYRO, INV_Y_GYRO, INV_Z_GYRO
+ *  \n INV_XYZ_GYRO
+ *  \n INV_XYZ_ACCEL
+ *  \n INV_WXYZ_QUAT
+ *  \n If the FIFO has no new data, @e sensors will be zero.
+ *  \n If the FIFO is disabled, @e sensors will be zero and this function will
+ *  return a non-zero error code.
+ *  @param[out] gyro        Gyro data in hardware units.
+ *  @param[out] accel       Accel data in hardware units.
+ *  @param[out] quat        3-axis quaternion data in hardware units.
+ *  @param[out] timestamp   Timestamp in milliseconds.
+ *  @param[out] sensors     Mask of sensors read from FIFO.
+ *  @param[out] more        Number of remaining packets.
+ *  @return     0 if successful.
+ */
+int dmp_read_fifo(short *gyro, short *accel, long *quat,
+    unsigned long *timestamp, short *sensors, unsigned char *more)
+{
+    /* Room for the bytes read by fifo_resync. */
+    unsigned char fifo_data[2 * MAX_PACKET_LENGTH];
+    int resync;
+
+    /* TODO: sensors[0] only changes when dmp_enable_feature is called. We can
+     * cache this value and save some cycles.
+     */
+    sensors[0] = 0;
+
+    /* Get a packet. */
+    if (mpu_read_fifo_stream(dmp.packet_length, fifo_data, more))
+        return -1;
+
+    /* Parse DMP packet. */
+    if (parse_packet(fifo_data, gyro, accel, quat, sensors)) {
+        resync = fifo_resync(fifo_data, dmp.packet_length);
+        if ((resync < 0) ||
+            parse_packet(fifo_data + resync, gyro, accel, quat, sensors)) {
+            mpu_reset_fifo();
+            return -1;
+        }
+    }
+
     get_ms(timestamp);
     return 0;
 }
 
+/**
+ *  @brief      Get all buffered packets from the FIFO.
+ *  FIFO_COUNT is read once, then up to @e max_samples packets are burst read
+ *  and parsed into the caller's arrays, oldest first. Each array must hold at
+ *  least @e max_samples entries.
+ *  \n @e sensors has the same meaning as in @e dmp_read_fifo and applies to
+ *  every sample in the batch.
+ *  \n The newest packet in the FIFO is stamped with the current time and the
+ *  older ones are back-filled using the DMP FIFO rate.
+ *  \n If a corrupted packet is found, the alignment is recovered with
+ *  @e fifo_resync and only that packet is dropped. If that fails, the FIFO is
+ *  reset and -1 is returned; the @e count samples parsed before it are still
+ *  valid.
+ *  \n If the FIFO overflowed, it is realigned instead of reset and -2 is
+ *  returned; the @e count samples are valid, but packets were lost before
+ *  them.
+ *  @param[out] gyro        Gyro data in hardware units.
+ *  @param[out] accel       Accel data in hardware units.
+ *  @param[out] quat        3-axis quaternion data in hardware units.
+ *  @param[out] timestamp   Per-sample timestamps in milliseconds.
+ *  @param[out] sensors     Mask of sensors read from FIFO.
+ *  @param[in]  max_samples Capacity of the output arrays.
+ *  @param[out] count       Number of samples returned.
+ *  @param[out] more        Number of packets left in the FIFO.
+ *  @return     0 if successful, -2 if there is a gap before the samples.
+ */
+int dmp_read_fifo_batch(short (*gyro)[3], short (*accel)[3], long (*quat)[4],
+    unsigned long *timestamp, short *sensors, unsigned char max_samples,
+    unsigned char *count, unsigned char *more)
+{
+    /* One extra packet of room for the bytes read by fifo_resync. */
+    static unsigned char fifo_data[(DMP_BATCH_BURST_PACKETS + 1) *
+        MAX_PACKET_LENGTH];
+    unsigned short fifo_count, packets, this_read, ii, shift;
+    unsigned long now, period_ms;
+    short packet_sensors;
+    int result, resync;
+
+    sensors[0] = 0;
+    count[0] = 0;
+    more[0] = 0;
+    if (!dmp.packet_length)
+        return -1;
+
+    result = mpu_get_fifo_count(dmp.packet_length, &fifo_count);
+    if (result && (result != -2))
+        return -1;
+    fifo_count /= dmp.packet_length;
+    if (!fifo_count)
+        return result;
+
+    get_ms(&now);
+    period_ms = dmp.fifo_rate ? (1000 / dmp.fifo_rate) : 0;
+    packets = (fifo_count < max_samples) ? fifo_count : max_samples;
+
+    while (count[0] < packets) {
+        this_read = packets - count[0];
+        if (this_read > DMP_BATCH_BURST_PACKETS)
+            this_read = DMP_BATCH_BURST_PACKETS;
+        if (mpu_read_fifo_packets(dmp.packet_length, this_read, fifo_data))
+            return -1;
+        /* The FIFO is aligned again at the end of each burst, so at most one
+         * resync per burst.
+         */
+        shift = 0;
+        for (ii = 0; ii < this_read; ii++) {
+            unsigned char idx = count[0];
+            unsigned char *packet = fifo_data + ii * dmp.packet_length + shift;
+            if (parse_packet(packet, gyro[idx], accel[idx], quat[idx],
+                    &packet_sensors)) {
+                resync = shift ? -1 :
+                    fifo_resync(packet, (this_read - ii) * dmp.packet_length);
+                if ((resync < 0) || parse_packet(packet + resync, gyro[idx],
+                        accel[idx], quat[idx], &packet_sensors)) {
+                    mpu_reset_fifo();
+                    return -1;
+                }
+                shift = resync;
+            }
+            sensors[0] = packet_sensors;
+            timestamp[idx] = now - (fifo_count - 1 - idx) * period_ms;
+            count[0]++;
+        }
+    }
+
+    fifo_count -= packets;
+    more[0] = (fifo_count > 0xFF) ? 0xFF : fifo_count;
+    return result;
+}
+
+#if defined NRF52
+static struct {
+    /* One extra packet of room for the bytes read by fifo_resync. */
+    unsigned char data[(DMP_ASYNC_MAX_PACKETS + 1) * MAX_PACKET_LENGTH];
+    unsigned short packets;
+    unsigned short next;
+    unsigned short shift;
+    unsigned short fifo_more;
+    unsigned long now;
+    int result;
+    dmp_fifo_cb_t cb;
+} fifo_async;
+
+static void fifo_async_cb(int result, unsigned short packets,
+    unsigned short more)
+{
+    fifo_async.result = result;
+    fifo_async.packets = packets;
+    fifo_async.fifo_more = more;
+    fifo_async.next = 0;
+    fifo_async.shift = 0;
+    fifo_async.cb(result);
+}
+
+/**
+ *  @brief      Start a non-blocking read of all buffered DMP packets.
+ *  @e callback is executed in the TWI interrupt context once the packets are
+ *  in RAM. Decode them from thread context with @e dmp_get_fifo_batch.
+ *  @param[in]  callback    Completion callback.
+ *  @return     0 if the read was started.
+ */
+int dmp_read_fifo_async(dmp_fifo_cb_t callback)
+{
+    if (!dmp.packet_length || !callback)
+        return -1;
+
+    fifo_async.cb = callback;
+    fifo_async.packets = 0;
+    fifo_async.next = 0;
+    return mpu_read_fifo_stream_async(dmp.packet_length, DMP_ASYNC_MAX_PACKETS,
+        fifo_async.data, fifo_async_cb);
+}
+
+/**
+ *  @brief      Decode packets read by @e dmp_read_fifo_async.
+ *  Can be called repeatedly until @e count is zero. The arguments have the
+ *  same meaning as in @e dmp_read_fifo_batch; @e more also counts the
+ *  packets that did not fit in the read buffer, in which case another read
+ *  should be started.
+ *  \n If the FIFO overflowed, the first call returns -2 along with the
+ *  samples read after the gap. If the read failed, -1 is returned.
+ *  @param[out] gyro        Gyro data in hardware units.
+ *  @param[out] accel       Accel data in hardware units.
+ *  @param[out] quat        3-axis quaternion data in hardware units.
+ *  @param[out] timestamp   Per-sample timestamps in milliseconds.
+ *  @param[out] sensors     Mask of sensors read from FIFO.
+ *  @param[in]  max_samples Capacity of the output arrays.
+ *  @param[out] count       Number of samples returned.
+ *  @param[out] more        Number of packets not returned yet.
+ *  @return     0 if successful, -2 if there is a gap before the samples.
+ */
+int dmp_get_fifo_batch(short (*gyro)[3], short (*accel)[3], long (*quat)[4],
+    unsigned long *timestamp, short *sensors, unsigned char max_samples,
+    unsigned char *count, unsigned char *more)
+{
+    unsigned long period_ms;
+    unsigned short total, left;
+    short packet_sensors;
+    int result, resync;
+
+    sensors[0] = 0;
+    count[0] = 0;
+    more[0] = 0;
+
+    /* Report the result once, with the first samples. */
+    result = fifo_async.result;
+    fifo_async.result = 0;
+    if (result == -1) {
+        fifo_async.packets = 0;
+        return -1;
+    }
+
+    if (!fifo_async.next)
+        get_ms(&fifo_async.now);
+    period_ms = dmp.fifo_rate ? (1000 / dmp.fifo_rate) : 0;
+    total = fifo_async.packets + fifo_async.fifo_more;
+
+    while ((fifo_async.next < fifo_async.packets) &&
+           (count[0] < max_samples)) {
+        unsigned char idx = count[0];
+        unsigned char *packet = fifo_async.data +
+            fifo_async.next * dmp.packet_length + fifo_async.shift;
+        if (parse_packet(packet, gyro[idx], accel[idx], quat[idx],
+                &packet_sensors)) {
+            resync = fifo_async.shift ? -1 : fifo_resync(packet,
+                (fifo_async.packets - fifo_async.next) * dmp.packet_length);
+            if ((resync < 0) || parse_packet(packet + resync, gyro[idx],
+                    accel[idx], quat[idx], &packet_sensors)) {
+                mpu_reset_fifo();
+                fifo_async.packets = 0;
+                fifo_async.fifo_more = 0;
+                return -1;
+            }
+            fifo_async.shift = resync;
+        }
+        sensors[0] = packet_sensors;
+        timestamp[idx] = fifo_async.now -
+            (total - 1 - fifo_async.next) * period_ms;
+        fifo_async.next++;
+        count[0]++;
+    }
+
+    left = total - fifo_async.next;
+    more[0] = (left > 0xFF) ? 0xFF : left;
+    return result;
+}
+#endif
+
 /**
  *  @brief      Register a function to be executed on a tap event.
  *  The tap direction is represented by one of the following:
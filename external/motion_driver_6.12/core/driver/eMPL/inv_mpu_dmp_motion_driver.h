@@ -56,6 +56,7 @@ int dmp_get_fifo_rate(unsigned short *rate);
 int dmp_enable_feature(unsigned short mask);
 int dmp_get_enabled_features(unsigned short *mask);
 int dmp_set_interrupt_mode(unsigned char mode);
+int dmp_get_packet_length(unsigned char *length);
 int dmp_set_orientation(unsigned short orient);
 int dmp_set_gyro_bias(long *bias);
 int dmp_set_accel_bias(long *bias);
@@ -92,6 +93,22 @@ int dmp_enable_gyro_cal(unsigned char enable);
  */
 int dmp_read_fifo(short *gyro, short *accel, long *quat,
     unsigned long *timestamp, short *sensors, unsigned char *more);
+int dmp_read_fifo_batch(short (*gyro)[3], short (*accel)[3], long (*quat)[4],
+    unsigned long *timestamp, short *sensors, unsigned char max_samples,
+    unsigned char *count, unsigned char *more);
+int dmp_get_resync_count(unsigned long *count);
+
+#if defined NRF52
+/* Non-blocking read. The callback is executed in the TWI interrupt context;
+ * the packets are decoded later from thread context.
+ */
+typedef void (*dmp_fifo_cb_t)(int result);
+
+int dmp_read_fifo_async(dmp_fifo_cb_t callback);
+int dmp_get_fifo_batch(short (*gyro)[3], short (*accel)[3], long (*quat)[4],
+    unsigned long *timestamp, short *sensors, unsigned char max_samples,
+    unsigned char *count, unsigned char *more);
+#endif
 
 #endif  /* #ifndef _INV_MPU_DMP_MOTION_DRIVER_H_ */
 
@@ -36,6 +36,7 @@
 
 #include "packet.h"
 #include "log.h"
+#include "profile.h"
 #include "bsp.h"
 
 #define BUF_SIZE        (256)
@@ -83,11 +84,13 @@ int _MLPrintLog (int priority, const char* tag, const char* fmt, ...)
         return 0;
     }
 
+    PROFILE_START(start);
     va_start(args, fmt);
     
     length = vsprintf(buf, fmt, args);
     if (length <= 0) {
         va_end(args);
+        PROFILE_STOP(start, _MLPrintLog, "_MLPrintLog");
         return length;
     }
 
@@ -115,6 +118,7 @@ int _MLPrintLog (int priority, const char* tag, const char* fmt, ...)
             
     va_end(args);
 
+    PROFILE_STOP(start, _MLPrintLog, "_MLPrintLog");
     return 0;
 }
 
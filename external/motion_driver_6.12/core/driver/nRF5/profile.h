@@ -0,0 +1,69 @@
+/**
+ *  @defgroup nRF5_System_Layer nRF5 System Layer
+ *  @brief  nRF5 System Layer APIs.
+ *
+ *  @{
+ *      @file   profile.h
+ *      @brief  Cycle count profiling of the MPL and driver calls.
+ */
+
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <stdint.h>
+
+/* Build with -DPROFILE_ENABLED=1 to keep call counts, total and worst-case
+ * DWT cycles per function. Otherwise the hooks compile to nothing.
+ * Entries are keyed by the function's address, so the MPL callbacks
+ * registered through inv_register_data_cb, which come from the closed
+ * library, can be matched against the map file.
+ */
+#ifndef PROFILE_ENABLED
+#define PROFILE_ENABLED         0
+#endif
+
+#if PROFILE_ENABLED
+
+#define PROFILE_MAX_ENTRIES     (24)
+
+/**
+ *  @brief  Start the DWT cycle counter and clear the table.
+ */
+void profile_init(void);
+
+/**
+ *  @brief      Current cycle count, the start of a profiled call.
+ *  @return     DWT cycle count.
+ */
+uint32_t profile_begin(void);
+
+/**
+ *  @brief      Account a call that started at @e start.
+ *  @param[in]  key     Address of the profiled function.
+ *  @param[in]  name    Name shown in the dump, NULL to show the address.
+ *  @param[in]  start   Cycle count from profile_begin.
+ */
+void profile_end(void const *key, const char *name, uint32_t start);
+
+/**
+ *  @brief  Print the table to the log, sorted as first called.
+ */
+void profile_dump(void);
+
+#define PROFILE_INIT()                  profile_init()
+#define PROFILE_START(VAR)              uint32_t VAR = profile_begin()
+#define PROFILE_STOP(VAR, KEY, NAME)    profile_end((void const *)(KEY), NAME, VAR)
+
+#else
+
+#define PROFILE_INIT()
+#define PROFILE_START(VAR)
+#define PROFILE_STOP(VAR, KEY, NAME)
+
+#endif
+
+#endif /* __PROFILE_H__ */
+
+/**
+ * @}
+ */
@@ -0,0 +1,100 @@
+/**
+ *  @defgroup nRF5_System_Layer nRF5 System Layer
+ *  @brief  nRF5 System Layer APIs.
+ *
+ *  @{
+ *      @file   profile_nRF5.c
+ *      @brief  Cycle count profiling with the Cortex-M4 DWT.
+ */
+
+#include "profile.h"
+
+#if PROFILE_ENABLED
+
+#include <string.h>
+#include "nrf.h"
+#include "nrf_log.h"
+
+struct profile_entry_s {
+    void const *key;
+    const char *name;
+    uint32_t calls;
+    uint32_t max_cycles;
+    uint64_t cycles;
+};
+
+static struct profile_entry_s profile_table[PROFILE_MAX_ENTRIES];
+static unsigned char profile_count;
+static unsigned long profile_overflows;
+
+void profile_init(void)
+{
+    memset(profile_table, 0, sizeof(profile_table));
+    profile_count = 0;
+    profile_overflows = 0;
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+uint32_t profile_begin(void)
+{
+    return DWT->CYCCNT;
+}
+
+void profile_end(void const *key, const char *name, uint32_t start)
+{
+    /* Read first so the lookup isn't counted. */
+    uint32_t cycles = DWT->CYCCNT - start;
+    struct profile_entry_s *entry;
+    unsigned char ii;
+
+    for (ii = 0; ii < profile_count; ii++) {
+        if (profile_table[ii].key == key)
+            break;
+    }
+    if (ii == profile_count) {
+        if (profile_count == PROFILE_MAX_ENTRIES) {
+            profile_overflows++;
+            return;
+        }
+        profile_table[ii].key = key;
+        profile_table[ii].name = name;
+        profile_count++;
+    }
+    entry = &profile_table[ii];
+    entry->calls++;
+    entry->cycles += cycles;
+    if (cycles > entry->max_cycles)
+        entry->max_cycles = cycles;
+}
+
+void profile_dump(void)
+{
+    struct profile_entry_s const *entry;
+    unsigned char ii;
+
+    NRF_LOG_INFO("Profile, %u cycles/us:\r\n", SystemCoreClock / 1000000);
+    for (ii = 0; ii < profile_count; ii++) {
+        entry = &profile_table[ii];
+        if (entry->name) {
+            NRF_LOG_INFO("%s: %u calls, avg %u max %u, total %u ms\r\n",
+                (uint32_t)entry->name, entry->calls,
+                (uint32_t)(entry->cycles / entry->calls), entry->max_cycles,
+                (uint32_t)(entry->cycles / (SystemCoreClock / 1000)));
+        } else {
+            NRF_LOG_INFO("0x%08x: %u calls, avg %u max %u, total %u ms\r\n",
+                (uint32_t)entry->key, entry->calls,
+                (uint32_t)(entry->cycles / entry->calls), entry->max_cycles,
+                (uint32_t)(entry->cycles / (SystemCoreClock / 1000)));
+        }
+    }
+    if (profile_overflows)
+        NRF_LOG_INFO("%u calls not profiled, table full\r\n", profile_overflows);
+}
+
+#endif
+
+/**
+ * @}
+ */
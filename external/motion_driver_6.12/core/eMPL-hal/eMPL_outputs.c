@@ -20,6 +20,7 @@
 #include "start_manager.h"
 #include "data_builder.h"
 #include "results_holder.h"
+#include "profile.h"
 
 struct eMPL_output_s {
     long quat[4];
@@ -29,10 +30,24 @@ struct eMPL_output_s {
     int compass_status;
     int nine_axis_status;
     inv_time_t nine_axis_timestamp;
+    /* Incremented each time an output gets a new value. */
+    unsigned long generation[INV_OUTPUT_NUM];
 };
 
 static struct eMPL_output_s eMPL_out;
 
+/* Check an output against the generation the caller last read, and update
+ * it if the output has changed since.
+ */
+static int output_is_newer(enum inv_eMPL_output_e output,
+    unsigned long *generation)
+{
+    if (generation[0] == eMPL_out.generation[output])
+        return 0;
+    generation[0] = eMPL_out.generation[output];
+    return 1;
+}
+
 /**
  *  @brief      Acceleration (g's) in body frame.
  *  Embedded MPL defines gravity as positive acceleration pointing away from
@@ -153,6 +168,7 @@ int inv_get_sensor_type_euler(long *data, int8_t *accuracy, inv_time_t *timestam
     long t1, t2, t3;
     long q00, q01, q02, q03, q11, q12, q13, q22, q23, q33;
     float values[3];
+    PROFILE_START(start);
 
     q00 = inv_q29_mult(eMPL_out.quat[0], eMPL_out.quat[0]);
     q01 = inv_q29_mult(eMPL_out.quat[0], eMPL_out.quat[1]);
@@ -208,6 +224,7 @@ int inv_get_sensor_type_euler(long *data, int8_t *accuracy, inv_time_t *timestam
 
     accuracy[0] = eMPL_out.quat_accuracy;
     timestamp[0] = eMPL_out.nine_axis_timestamp;
+    PROFILE_STOP(start, inv_get_sensor_type_euler, "inv_get_sensor_type_euler");
     return eMPL_out.nine_axis_status;
 }
 
@@ -227,6 +244,94 @@ int inv_get_sensor_type_rot_mat(long *data, int8_t *accuracy, inv_time_t *timest
     return eMPL_out.nine_axis_status;
 }
 
+/**
+ *  @brief      Number of values produced by an output.
+ *  Compare with a previous value to tell whether the output has changed.
+ *  @param[in]  output  Output, see inv_eMPL_output_e.
+ *  @return     Generation counter, wraps around.
+ */
+unsigned long inv_get_eMPL_generation(enum inv_eMPL_output_e output)
+{
+    if (output >= INV_OUTPUT_NUM)
+        return 0;
+    return eMPL_out.generation[output];
+}
+
+/**
+ *  @brief      Acceleration, if updated since the generation given.
+ *  The _if_newer getters only compute and return the output if it has
+ *  changed since @e generation, which is then updated.
+ *  @param[out] data        See inv_get_sensor_type_accel.
+ *  @param[out] accuracy    Accuracy of the measurement from 0 (least accurate)
+ *                          to 3 (most accurate).
+ *  @param[out] timestamp   The time in milliseconds when this sensor was read.
+ *  @param[in,out] generation   Generation of the last value read.
+ *  @return     1 if there was a new value.
+ */
+int inv_get_sensor_type_accel_if_newer(long *data, int8_t *accuracy,
+    inv_time_t *timestamp, unsigned long *generation)
+{
+    if (!output_is_newer(INV_OUTPUT_ACCEL, generation))
+        return 0;
+    inv_get_sensor_type_accel(data, accuracy, timestamp);
+    return 1;
+}
+
+int inv_get_sensor_type_gyro_if_newer(long *data, int8_t *accuracy,
+    inv_time_t *timestamp, unsigned long *generation)
+{
+    if (!output_is_newer(INV_OUTPUT_GYRO, generation))
+        return 0;
+    inv_get_sensor_type_gyro(data, accuracy, timestamp);
+    return 1;
+}
+
+int inv_get_sensor_type_compass_if_newer(long *data, int8_t *accuracy,
+    inv_time_t *timestamp, unsigned long *generation)
+{
+    if (!output_is_newer(INV_OUTPUT_COMPASS, generation))
+        return 0;
+    inv_get_sensor_type_compass(data, accuracy, timestamp);
+    return 1;
+}
+
+int inv_get_sensor_type_quat_if_newer(long *data, int8_t *accuracy,
+    inv_time_t *timestamp, unsigned long *generation)
+{
+    if (!output_is_newer(INV_OUTPUT_QUAT, generation))
+        return 0;
+    inv_get_sensor_type_quat(data, accuracy, timestamp);
+    return 1;
+}
+
+/* The trig in the quaternion-derived outputs is skipped when stale. */
+int inv_get_sensor_type_euler_if_newer(long *data, int8_t *accuracy,
+    inv_time_t *timestamp, unsigned long *generation)
+{
+    if (!output_is_newer(INV_OUTPUT_QUAT, generation))
+        return 0;
+    inv_get_sensor_type_euler(data, accuracy, timestamp);
+    return 1;
+}
+
+int inv_get_sensor_type_rot_mat_if_newer(long *data, int8_t *accuracy,
+    inv_time_t *timestamp, unsigned long *generation)
+{
+    if (!output_is_newer(INV_OUTPUT_QUAT, generation))
+        return 0;
+    inv_get_sensor_type_rot_mat(data, accuracy, timestamp);
+    return 1;
+}
+
+int inv_get_sensor_type_heading_if_newer(long *data, int8_t *accuracy,
+    inv_time_t *timestamp, unsigned long *generation)
+{
+    if (!output_is_newer(INV_OUTPUT_QUAT, generation))
+        return 0;
+    inv_get_sensor_type_heading(data, accuracy, timestamp);
+    return 1;
+}
+
 static inv_error_t inv_generate_eMPL_outputs
     (struct inv_sensor_cal_t *sensor_cal)
 {
@@ -274,8 +379,16 @@ static inv_error_t inv_generate_eMPL_outputs
         eMPL_out.nine_axis_timestamp = sensor_cal->quat.timestamp;
         break;
     }
-    
-    
+
+    if (eMPL_out.accel_status & INV_NEW_DATA)
+        eMPL_out.generation[INV_OUTPUT_ACCEL]++;
+    if (eMPL_out.gyro_status & INV_NEW_DATA)
+        eMPL_out.generation[INV_OUTPUT_GYRO]++;
+    if (eMPL_out.compass_status & INV_NEW_DATA)
+        eMPL_out.generation[INV_OUTPUT_COMPASS]++;
+    if (eMPL_out.nine_axis_status)
+        eMPL_out.generation[INV_OUTPUT_QUAT]++;
+
     return INV_SUCCESS;
 }
 
@@ -30,6 +30,34 @@ extern "C" {
     int inv_get_sensor_type_rot_mat(long *data, int8_t *accuracy, inv_time_t *timestamp);
     int inv_get_sensor_type_heading(long *data, int8_t *accuracy, inv_time_t *timestamp);
 
+    /* Outputs with a generation counter. Euler angles, heading and the
+     * rotation matrix are derived from the quaternion.
+     */
+    enum inv_eMPL_output_e {
+        INV_OUTPUT_ACCEL = 0,
+        INV_OUTPUT_GYRO,
+        INV_OUTPUT_COMPASS,
+        INV_OUTPUT_QUAT,
+        INV_OUTPUT_NUM
+    };
+
+    unsigned long inv_get_eMPL_generation(enum inv_eMPL_output_e output);
+
+    int inv_get_sensor_type_accel_if_newer(long *data, int8_t *accuracy,
+        inv_time_t *timestamp, unsigned long *generation);
+    int inv_get_sensor_type_gyro_if_newer(long *data, int8_t *accuracy,
+        inv_time_t *timestamp, unsigned long *generation);
+    int inv_get_sensor_type_compass_if_newer(long *data, int8_t *accuracy,
+        inv_time_t *timestamp, unsigned long *generation);
+    int inv_get_sensor_type_quat_if_newer(long *data, int8_t *accuracy,
+        inv_time_t *timestamp, unsigned long *generation);
+    int inv_get_sensor_type_euler_if_newer(long *data, int8_t *accuracy,
+        inv_time_t *timestamp, unsigned long *generation);
+    int inv_get_sensor_type_rot_mat_if_newer(long *data, int8_t *accuracy,
+        inv_time_t *timestamp, unsigned long *generation);
+    int inv_get_sensor_type_heading_if_newer(long *data, int8_t *accuracy,
+        inv_time_t *timestamp, unsigned long *generation);
+
     inv_error_t inv_enable_eMPL_outputs(void);
     inv_error_t inv_disable_eMPL_outputs(void);
 
@@ -28,6 +28,7 @@
 #include "results_holder.h"
 
 #include "log.h"
+#include "profile.h"
 #undef MPL_LOG_TAG
 #define MPL_LOG_TAG "MPL"
 
@@ -927,6 +928,7 @@ inv_error_t inv_execute_on_data(void)
     inv_error_t result, first_error;
     int kk;
     int mode;
+    PROFILE_START(start);
 
 #ifdef INV_PLAYBACK_DBG
     if (inv_data_builder.debug_mode == RD_RECORD) {
@@ -951,7 +953,12 @@ inv_error_t inv_execute_on_data(void)
 
     for (kk = 0; kk < inv_data_builder.num_cb; ++kk) {
         if (mode & inv_data_builder.process[kk].data_required) {
+            /* Attributed to the callback's address, most of them are in
+             * the closed library.
+             */
+            PROFILE_START(cb_start);
             result = inv_data_builder.process[kk].func(&sensors);
+            PROFILE_STOP(cb_start, inv_data_builder.process[kk].func, NULL);
             if (result && !first_error) {
                 first_error = result;
             }
@@ -960,6 +967,7 @@ inv_error_t inv_execute_on_data(void)
 
     inv_set_contiguous();
 
+    PROFILE_STOP(start, inv_execute_on_data, "inv_execute_on_data");
     return first_error;
 }
 